@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Run the executable tests with the bytecode interpreter and
+# compare against the output of the operation tree.
+
+tests="boolean_type.rc
+int_type.rc
+heap_type.rc
+variable_initialization.rc
+initializer_args.rc
+var.rc
+logical_operators.rc
+integer_literals.rc
+float_literals.rc
+string_literals.rc
+conversion.rc
+call.rc
+inline.rc
+precondition_cache.rc
+hoist.rc
+stack_allocate.rc
+batch.rc
+typed_gc.rc
+two_reactions.rc"
+
+echo 1..`echo "$tests" | wc -l`
+
+num=1
+for t in $tests
+do
+    expected=`$RCGO $srcdir/$t 2>&1`
+    actual=`$RCGO --bytecode $srcdir/$t 2>&1`
+    if test "$actual" == "$expected"
+    then
+        echo "ok $num - bytecode ($t)"
+    else
+        echo "not ok $num - bytecode ($t)"
+    fi
+    num=`expr $num + 1`
+done
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+echo 1..3
+
+expected=`$RCGO --no-fuse $srcdir/fusion.rc 2>&1`
+actual=`$RCGO $srcdir/fusion.rc 2>/dev/null`
+
+if test "$actual" == "$expected"
+then
+    echo 'ok 1 - fused and unfused output agree'
+else
+    echo 'not ok 1 - fused and unfused output agree'
+fi
+
+report=`$RCGO --fusion-report $srcdir/fusion.rc 2>&1 >/dev/null`
+
+echo "$report"
+
+if echo "$report" | grep -q -F 'Load (FieldAddress) -> LoadField'
+then
+    echo 'ok 2 - report load field'
+else
+    echo 'not ok 2 - report load field'
+fi
+
+if echo "$report" | grep -q -F 'Increment (FieldAddress) -> IncrementField'
+then
+    echo 'ok 3 - report increment field'
+else
+    echo 'not ok 3 - report increment field'
+fi
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Run the executable tests with generational heaps and
+# compare against the output with full collections only.
+
+tests="heap_type.rc
+variable_initialization.rc
+call.rc
+typed_gc.rc
+generational.rc
+two_reactions.rc"
+
+echo 1..`expr \`echo "$tests" | wc -l\` \* 3`
+
+num=1
+for t in $tests
+do
+    expected=`$RCGO $srcdir/$t 2>&1`
+    for options in "" "--bytecode" "--native"
+    do
+        actual=`$RCGO --generational $options $srcdir/$t 2>&1`
+        if test "$actual" == "$expected"
+        then
+            echo "ok $num - generational $options ($t)"
+        else
+            echo "not ok $num - generational $options ($t)"
+        fi
+        num=`expr $num + 1`
+    done
+done
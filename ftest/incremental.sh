@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Run the executable tests with incremental collection and
+# compare against the output with collections that run to completion.
+
+tests="heap_type.rc
+variable_initialization.rc
+call.rc
+typed_gc.rc
+generational.rc
+two_reactions.rc"
+
+echo 1..`expr \`echo "$tests" | wc -l\` \* 3`
+
+num=1
+for t in $tests
+do
+    expected=`$RCGO $srcdir/$t 2>&1`
+    for options in "" "--bytecode" "--generational"
+    do
+        actual=`$RCGO --gc-budget=1 $options $srcdir/$t 2>&1`
+        if test "$actual" == "$expected"
+        then
+            echo "ok $num - incremental $options ($t)"
+        else
+            echo "not ok $num - incremental $options ($t)"
+        fi
+        num=`expr $num + 1`
+    done
+done
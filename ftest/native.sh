@@ -0,0 +1,40 @@
+#!/bin/bash
+
+# Run the executable tests with native code and
+# compare against the output of the operation tree.
+
+tests="int_type.rc
+heap_type.rc
+logical_operators.rc
+call.rc
+inline.rc
+stack_allocate.rc
+fold.rc
+two_reactions.rc"
+
+echo 1..`expr \`echo "$tests" | wc -l\` + 1`
+
+num=1
+for t in $tests
+do
+    expected=`$RCGO $srcdir/$t 2>&1`
+    actual=`$RCGO --native $srcdir/$t 2>&1`
+    if test "$actual" == "$expected"
+    then
+        echo "ok $num - native ($t)"
+    else
+        echo "not ok $num - native ($t)"
+    fi
+    num=`expr $num + 1`
+done
+
+out=`mktemp`
+expected=`$RCGO $srcdir/call.rc 2>&1`
+actual=`$RCGO --emit-cxx=$out $srcdir/call.rc 2>&1`
+if test "$actual" == "$expected" && grep -q rc_native_init $out
+then
+    echo "ok $num - emit C++"
+else
+    echo "not ok $num - emit C++"
+fi
+rm -f $out
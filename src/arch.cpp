@@ -1,5 +1,7 @@
 #include "arch.hpp"
 
+#include <cstddef>
+
 #include "util.hpp"
 #include "type.hpp"
 #include "parameter_list.hpp"
@@ -267,4 +269,111 @@ size_t offset (const decl::Field* field)
     }
   return align_up (sz, alignment (field->type));
 }
+
+void pointer_offsets (const Type* type, size_t offset, std::vector<size_t>& offsets)
+{
+  switch (type->underlying_kind ())
+    {
+    // These types cannot be allocated.
+    case Untyped_Nil_Kind:
+    case Untyped_Boolean_Kind:
+    case Untyped_Rune_Kind:
+    case Untyped_Integer_Kind:
+    case Untyped_Float_Kind:
+    case Untyped_Complex_Kind:
+    case Untyped_String_Kind:
+
+    case Heap_Kind:
+
+    case Method_Kind:
+    case Initializer_Kind:
+    case Getter_Kind:
+    case Reaction_Kind:
+
+    case Polymorphic_Function_Kind:
+
+    case Named_Kind:
+      NOT_REACHED;
+
+    case Bool_Kind:
+    case Uint8_Kind:
+    case Uint16_Kind:
+    case Uint32_Kind:
+    case Uint64_Kind:
+    case Int8_Kind:
+    case Int16_Kind:
+    case Int32_Kind:
+    case Int64_Kind:
+    case Float32_Kind:
+    case Float64_Kind:
+    case Complex64_Kind:
+    case Complex128_Kind:
+    case Uint_Kind:
+    case Int_Kind:
+    case Uintptr_Kind:
+      return;
+
+    case String_Kind:
+      offsets.push_back (offset + offsetof (runtime::String, ptr));
+      return;
+
+    case Struct_Kind:
+    case Component_Kind:
+    {
+      size_t sz = 0;
+      const Struct* s = type->underlying_type ()->to_struct ();
+      for (Struct::const_iterator pos = s->begin (), limit = s->end ();
+           pos != limit;
+           ++pos)
+        {
+          const Type* field_type = (*pos)->type;
+          sz = align_up (sz, alignment (field_type));
+          pointer_offsets (field_type, offset + sz, offsets);
+          sz += size (field_type);
+        }
+      return;
+    }
+    case Array_Kind:
+    {
+      const Array* a = type->underlying_type ()->to_array ();
+      std::vector<size_t> unit;
+      pointer_offsets (a->base_type, 0, unit);
+      if (!unit.empty ())
+        {
+          for (long idx = 0; idx != a->dimension; ++idx)
+            {
+              for (size_t k = 0; k != unit.size (); ++k)
+                {
+                  offsets.push_back (offset + idx * unit_size (a) + unit[k]);
+                }
+            }
+        }
+      return;
+    }
+    case Map_Kind:
+      UNIMPLEMENTED;
+    case Pointer_Kind:
+      offsets.push_back (offset);
+      return;
+    case Slice_Kind:
+      offsets.push_back (offset + offsetof (runtime::Slice, ptr));
+      return;
+
+    case Function_Kind:
+    case Push_Port_Kind:
+      offsets.push_back (offset);
+      return;
+    case Pull_Port_Kind:
+      offsets.push_back (offset + offsetof (runtime::PullPort, instance));
+      return;
+
+    case Interface_Kind:
+      UNIMPLEMENTED;
+
+    case File_Descriptor_Kind:
+      offsets.push_back (offset);
+      return;
+    }
+  NOT_REACHED;
+}
 }
@@ -3,6 +3,8 @@
 
 #include "types.hpp"
 
+#include <vector>
+
 namespace arch
 {
 // Alignment of the stack in bytes.  Typically 4 (32-bits) or 8 (64-bits).
@@ -16,6 +18,8 @@ size_t unit_size (const type::Slice* slice);
 size_t size_on_stack (const type::Type* type);
 size_t size_on_stack (const decl::ParameterList* list);
 size_t offset (const decl::Field* field);
+// Append the offsets of the words of type that may contain pointers.
+void pointer_offsets (const type::Type* type, size_t offset, std::vector<size_t>& offsets);
 }
 
 #endif // RC_SRC_ARCH_HPP
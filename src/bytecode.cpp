@@ -0,0 +1,336 @@
+#include "bytecode.hpp"
+
+#include "operation.hpp"
+#include "callable.hpp"
+#include "heap.hpp"
+
+namespace runtime
+{
+
+size_t
+Compiler::emit (Opcode opcode)
+{
+  code_.push_back (Instruction (opcode));
+  return code_.size () - 1;
+}
+
+size_t
+Compiler::emit_execute (const Operation* operation)
+{
+  size_t idx = emit (Op_Execute);
+  code_[idx].operation = operation;
+  return idx;
+}
+
+size_t
+Compiler::emit_apply (ApplyFunction function, const Operation* operation)
+{
+  size_t idx = emit (Op_Apply);
+  code_[idx].function = function;
+  code_[idx].operation = operation;
+  return idx;
+}
+
+size_t
+Compiler::emit_offset (Opcode opcode, ptrdiff_t offset)
+{
+  size_t idx = emit (opcode);
+  code_[idx].offset = offset;
+  return idx;
+}
+
+size_t
+Compiler::emit_size (Opcode opcode, size_t size)
+{
+  size_t idx = emit (opcode);
+  code_[idx].size = size;
+  return idx;
+}
+
+size_t
+Compiler::emit_offset_size (Opcode opcode, ptrdiff_t offset, size_t size)
+{
+  size_t idx = emit (opcode);
+  code_[idx].offset = offset;
+  code_[idx].size = size;
+  return idx;
+}
+
+size_t
+Compiler::emit_data (const void* data, size_t size)
+{
+  size_t idx = emit (Op_Push_Bytes);
+  code_[idx].data = data;
+  code_[idx].size = size;
+  return idx;
+}
+
+size_t
+Compiler::emit_call (const decl::Callable* callable)
+{
+  size_t idx = emit (Op_Call);
+  code_[idx].callable = callable;
+  return idx;
+}
+
+size_t
+Compiler::emit_jump (Opcode opcode)
+{
+  return emit (opcode);
+}
+
+void
+Compiler::patch (size_t jump, size_t target)
+{
+  assert (jump < code_.size ());
+  code_[jump].offset = target;
+}
+
+size_t
+Compiler::here () const
+{
+  return code_.size ();
+}
+
+const Compiler::CodeType&
+Compiler::code () const
+{
+  return code_;
+}
+
+static Compiler::CodeType
+translate (const Operation* root)
+{
+  Compiler compiler;
+  root->compile (compiler);
+  compiler.emit (Op_End);
+  return compiler.code ();
+}
+
+Bytecode::Bytecode (const Operation* a_root)
+  : root (a_root)
+  , code (translate (a_root))
+{ }
+
+#if defined (__GNUC__)
+#define RC_THREADED_DISPATCH 1
+#endif
+
+Control
+Bytecode::execute (ExecutorBase& exec) const
+{
+  const Instruction* const begin = &code[0];
+  const Instruction* ip = begin;
+  Stack& stack = exec.stack ();
+
+#ifdef RC_THREADED_DISPATCH
+  static void* const dispatch_table[] =
+  {
+    &&Op_Execute_Label,
+    &&Op_Apply_Label,
+    &&Op_Push_Address_Label,
+    &&Op_Push_Bytes_Label,
+    &&Op_Load_Label,
+    &&Op_Select_Label,
+    &&Op_Assign_Label,
+    &&Op_Assign_Barrier_Label,
+    &&Op_Clear_Label,
+    &&Op_Popn_Label,
+    &&Op_Reserve_Label,
+    &&Op_Call_Label,
+    &&Op_Move_Label,
+    &&Op_Return_Label,
+    &&Op_Jump_Label,
+    &&Op_Jump_If_False_Label,
+    &&Op_Jump_If_True_Or_Pop_Label,
+    &&Op_Jump_If_False_Or_Pop_Label,
+    &&Op_End_Label,
+  };
+#define TARGET(op) op##_Label
+#define DISPATCH goto *dispatch_table[ip->opcode]
+  DISPATCH;
+    {
+#else
+#define TARGET(op) case op
+#define DISPATCH goto dispatch
+dispatch:
+  switch (ip->opcode)
+    {
+#endif
+      TARGET (Op_Execute):
+      if (ip->operation->execute (exec) == Control_Return)
+        {
+          return Control_Return;
+        }
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Apply):
+      ip->function (exec, ip->operation);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Push_Address):
+      stack.push_address (ip->offset);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Push_Bytes):
+      stack.load (ip->data, ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Load):
+      stack.load (stack.pop_pointer (), ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Select):
+      stack.push_pointer (static_cast<char*> (stack.pop_pointer ()) + ip->offset);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Assign):
+      stack.store_indirect (ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Assign_Barrier):
+      Heap::write_barrier (stack.store_indirect (ip->size), ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Clear):
+      stack.clear (ip->offset, ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Popn):
+      stack.popn (ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Reserve):
+      stack.reserve (ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Call):
+      {
+        const decl::Callable* callable = ip->callable;
+        // Push a fake instruction pointer.
+        stack.push_pointer (NULL);
+        // Setup the frame.
+        stack.setup (callable->memory_model.locals_size_on_stack ());
+        // Do the call.
+        callable->call (exec);
+        // Tear down the frame.
+        stack.teardown ();
+        // Pop the fake instruction pointer.
+        stack.pop_pointer ();
+        // Pop the arguments.
+        stack.popn (arch::size_on_stack (callable->parameter_list ()));
+      }
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Move):
+      stack.move (ip->offset, ip->size);
+      ++ip;
+      DISPATCH;
+
+      TARGET (Op_Return):
+      return Control_Return;
+
+      TARGET (Op_Jump):
+      ip = begin + ip->offset;
+      DISPATCH;
+
+      TARGET (Op_Jump_If_False):
+      {
+        bool c;
+        stack.pop (c);
+        ip = c ? ip + 1 : begin + ip->offset;
+      }
+      DISPATCH;
+
+      TARGET (Op_Jump_If_True_Or_Pop):
+      {
+        bool c;
+        stack.pop (c);
+        if (c)
+          {
+            stack.push (c);
+            ip = begin + ip->offset;
+          }
+        else
+          {
+            ++ip;
+          }
+      }
+      DISPATCH;
+
+      TARGET (Op_Jump_If_False_Or_Pop):
+      {
+        bool c;
+        stack.pop (c);
+        if (!c)
+          {
+            stack.push (c);
+            ip = begin + ip->offset;
+          }
+        else
+          {
+            ++ip;
+          }
+      }
+      DISPATCH;
+
+      TARGET (Op_End):
+      return Control_Continue;
+    }
+
+#undef TARGET
+#undef DISPATCH
+
+  NOT_REACHED;
+}
+
+static const char* const opcode_names[] =
+{
+  "Execute",
+  "Apply",
+  "Push_Address",
+  "Push_Bytes",
+  "Load",
+  "Select",
+  "Assign",
+  "Assign_Barrier",
+  "Clear",
+  "Popn",
+  "Reserve",
+  "Call",
+  "Move",
+  "Return",
+  "Jump",
+  "Jump_If_False",
+  "Jump_If_True_Or_Pop",
+  "Jump_If_False_Or_Pop",
+  "End",
+};
+
+void
+Bytecode::dump () const
+{
+  std::cout << "Bytecode(\n";
+  for (size_t idx = 0; idx != code.size (); ++idx)
+    {
+      const Instruction& i = code[idx];
+      std::cout << idx << ' ' << opcode_names[i.opcode]
+                << " offset=" << i.offset
+                << " size=" << i.size << '\n';
+    }
+  std::cout << ")\n";
+}
+
+}
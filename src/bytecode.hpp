@@ -0,0 +1,110 @@
+#ifndef RC_SRC_BYTECODE_HPP
+#define RC_SRC_BYTECODE_HPP
+
+#include "types.hpp"
+
+namespace runtime
+{
+
+// Opcodes of the bytecode interpreter.
+// The order must match the dispatch table in Bytecode::execute.
+enum Opcode
+{
+  // Execute an operation tree and propagate Control_Return.
+  Op_Execute,
+  // Call function with operation.
+  Op_Apply,
+  // Push base_pointer + offset.
+  Op_Push_Address,
+  // Push size bytes from data.
+  Op_Push_Bytes,
+  // Pop a pointer and push size bytes from it.
+  Op_Load,
+  // Pop a pointer and push pointer + offset.
+  Op_Select,
+  // Store size bytes to the pointer beneath them.
+  Op_Assign,
+  // Op_Assign followed by the write barrier.
+  Op_Assign_Barrier,
+  // Clear size bytes at base_pointer + offset.
+  Op_Clear,
+  // Pop size bytes.
+  Op_Popn,
+  // Reserve size bytes.
+  Op_Reserve,
+  // Call callable whose arguments have been pushed.
+  Op_Call,
+  // Move size bytes from the top of the stack to base_pointer + offset.
+  Op_Move,
+  // Return Control_Return.
+  Op_Return,
+  // Jump to offset.
+  Op_Jump,
+  // Pop a bool and jump to offset if it is false.
+  Op_Jump_If_False,
+  // Jump to offset if the bool on top is true, otherwise pop it.
+  Op_Jump_If_True_Or_Pop,
+  // Jump to offset if the bool on top is false, otherwise pop it.
+  Op_Jump_If_False_Or_Pop,
+  // Return Control_Continue.
+  Op_End,
+};
+
+// Function called by Op_Apply.
+// The operation is the node that emitted the instruction.
+typedef void (*ApplyFunction) (ExecutorBase& exec, const Operation* operation);
+
+struct Instruction
+{
+  Instruction (Opcode o)
+    : opcode (o)
+    , operation (NULL)
+    , offset (0)
+    , size (0)
+  { }
+  Opcode opcode;
+  union
+  {
+    const Operation* operation;
+    const decl::Callable* callable;
+    const void* data;
+  };
+  ApplyFunction function;
+  // Frame offset or jump target.
+  ptrdiff_t offset;
+  size_t size;
+};
+
+// Translates an operation tree into a linear sequence of instructions.
+// Operations describe themselves via Operation::compile.
+class Compiler
+{
+public:
+  typedef std::vector<Instruction> CodeType;
+
+  // Append an instruction and return its index.
+  size_t emit (Opcode opcode);
+  size_t emit_execute (const Operation* operation);
+  size_t emit_apply (ApplyFunction function, const Operation* operation);
+  size_t emit_offset (Opcode opcode, ptrdiff_t offset);
+  size_t emit_size (Opcode opcode, size_t size);
+  size_t emit_offset_size (Opcode opcode, ptrdiff_t offset, size_t size);
+  size_t emit_data (const void* data, size_t size);
+  size_t emit_call (const decl::Callable* callable);
+
+  // Emit a jump whose target is set by patch.
+  size_t emit_jump (Opcode opcode);
+  // Set the target of a jump to an index.
+  void patch (size_t jump, size_t target);
+  // Index of the next instruction.
+  size_t here () const;
+
+  const CodeType& code () const;
+
+private:
+  CodeType code_;
+};
+
+}
+
+#endif // RC_SRC_BYTECODE_HPP
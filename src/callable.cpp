@@ -217,7 +217,9 @@ bool Getter::process_declaration_i (util::ErrorReporter& er, Scope* file_scope)
 Action::Action (ast::ActionDecl* a_actiondecl,
                 const type::NamedType* a_named_type)
   : MethodBase (a_actiondecl->identifier->identifier, a_actiondecl->identifier->location, a_named_type)
+  , precondition_kind (Dynamic)
   , actiondecl (a_actiondecl)
+  , precondition_cacheable (false)
   , receiver_parameter_ (NULL)
   , iota_parameter_ (NULL)
   , dimension_ (-1)
@@ -7,6 +7,7 @@
 #include "symbol.hpp"
 #include "expression_value.hpp"
 #include "parameter_list.hpp"
+#include "field_set.hpp"
 
 namespace decl
 {
@@ -140,6 +141,10 @@ struct Action : public MethodBase
   ReceiverAccess precondition_access;
   ReceiverAccess immutable_phase_access;
   ast::ActionDecl* const actiondecl;
+  // True if the precondition only depends on precondition_reads.
+  bool precondition_cacheable;
+  semantic::FieldSet precondition_reads;
+  semantic::FieldSet writes;
 
   Parameter* receiver_parameter () const;
   Parameter* iota_parameter () const;
@@ -160,6 +165,7 @@ struct Reaction : public MethodBase
 
   ast::ReactionDecl* const reactiondecl;
   ReceiverAccess immutable_phase_access;
+  semantic::FieldSet writes;
 
   Symbol* iota () const;
   long dimension () const;
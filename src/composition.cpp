@@ -117,6 +117,9 @@ Action::Action (Instance* i,
   , instance (i)
   , action (a)
   , iota (p)
+  , precondition_cacheable (a->precondition_cacheable)
+  , possibly_enabled (true)
+  , batch_size (1)
 { }
 
 size_t
@@ -676,6 +679,101 @@ void Composer::compute_dependent_instances ()
     }
 }
 
+void Composer::compute_invalidations ()
+{
+  // Gather the actions with cacheable preconditions.
+  ActionsType cached;
+  for (InstancesType::const_iterator ipos = instances_.begin (),
+       ilimit = instances_.end ();
+       ipos != ilimit;
+       ++ipos)
+    {
+      for (ActionsType::const_iterator pos = ipos->second->actions.begin (),
+           limit = ipos->second->actions.end ();
+           pos != limit;
+           ++pos)
+        {
+          if ((*pos)->precondition_cacheable)
+            {
+              cached.push_back (*pos);
+            }
+        }
+    }
+
+  // Writers in the same instance invalidate the cached precondition.
+  // Writers in other instances are not ordered with the precondition by
+  // locking so the precondition cannot be cached.
+  for (InstancesType::const_iterator ipos = instances_.begin (),
+       ilimit = instances_.end ();
+       ipos != ilimit;
+       ++ipos)
+    {
+      for (ActionsType::const_iterator pos = ipos->second->actions.begin (),
+           limit = ipos->second->actions.end ();
+           pos != limit;
+           ++pos)
+        {
+          Action* writer = *pos;
+          for (ActionsType::const_iterator cpos = cached.begin (),
+               climit = cached.end ();
+               cpos != climit;
+               ++cpos)
+            {
+              Action* action = *cpos;
+              if (writer->action->writes.intersects (writer->instance->address, action->action->precondition_reads, action->instance->address))
+                {
+                  if (writer->instance == action->instance)
+                    {
+                      writer->invalidates.push_back (action);
+                    }
+                  else
+                    {
+                      action->precondition_cacheable = false;
+                    }
+                }
+            }
+        }
+    }
+
+  for (ReactionsType::const_iterator pos = reactions_.begin (),
+       limit = reactions_.end ();
+       pos != limit;
+       ++pos)
+    {
+      Reaction* writer = pos->second;
+      for (ActionsType::const_iterator cpos = cached.begin (),
+           climit = cached.end ();
+           cpos != climit;
+           ++cpos)
+        {
+          Action* action = *cpos;
+          if (writer->reaction->writes.intersects (writer->instance->address, action->action->precondition_reads, action->instance->address))
+            {
+              if (writer->instance == action->instance)
+                {
+                  writer->invalidates.push_back (action);
+                }
+              else
+                {
+                  action->precondition_cacheable = false;
+                }
+            }
+        }
+    }
+}
+
+void
+invalidate (const ActionsType& actions)
+{
+  for (ActionsType::const_iterator pos = actions.begin (),
+       limit = actions.end ();
+       pos != limit;
+       ++pos)
+    {
+      (*pos)->possibly_enabled = true;
+    }
+}
+
 static void tarjan (Node* n)
 {
   switch (n->state)
@@ -1222,6 +1320,7 @@ Composer::elaborate ()
   // The edges from activations to push ports are present.
   elaborate_bindings ();
   compute_dependent_instances ();
+  compute_invalidations ();
 }
 
 void
@@ -1243,6 +1342,84 @@ static void collect (std::set<Node*>& nodes, Node* n)
     }
 }
 
+// Returns true if the preconditions of actions can be evaluated before
+// any of their bodies run.
+static bool can_batch (ActionsType::const_iterator begin, ActionsType::const_iterator end)
+{
+  std::set<Node*> batch (begin, end);
+  std::set<Node*> nodes;
+  for (ActionsType::const_iterator pos = begin; pos != end; ++pos)
+    {
+      const Action* action = *pos;
+      // The precondition must only read fields that are tracked and the
+      // whole batch must run under one set of locks.
+      if (!action->precondition_cacheable ||
+          action->instance_set () != (*begin)->instance_set ())
+        {
+          return false;
+        }
+      collect (nodes, *pos);
+    }
+
+  // The body for one iota value may not change the precondition for
+  // another.
+  const decl::Action* action = (*begin)->action;
+  if (action->writes.intersects_other_iota (action->precondition_reads))
+    {
+      return false;
+    }
+
+  // The reactions triggered by the batch may not change a precondition
+  // in the batch.
+  for (std::set<Node*>::const_iterator pos = nodes.begin (), limit = nodes.end ();
+       pos != limit;
+       ++pos)
+    {
+      Reaction* reaction = dynamic_cast<Reaction*> (*pos);
+      if (reaction == NULL)
+        {
+          continue;
+        }
+      for (ActionsType::const_iterator apos = reaction->invalidates.begin (), alimit = reaction->invalidates.end ();
+           apos != alimit;
+           ++apos)
+        {
+          if (batch.count (*apos) != 0)
+            {
+              return false;
+            }
+        }
+    }
+
+  return true;
+}
+
+void
+Composer::batch_actions ()
+{
+  for (InstancesType::const_iterator ipos = instances_.begin (),
+       ilimit = instances_.end ();
+       ipos != ilimit;
+       ++ipos)
+    {
+      const ActionsType& actions = ipos->second->actions;
+      // The actions of a dimensioned action are adjacent and in iota order.
+      for (ActionsType::const_iterator pos = actions.begin (), limit = actions.end ();
+           pos != limit;
+           pos += (*pos)->batch_size)
+        {
+          Action* action = *pos;
+          long dimension = action->action->dimension ();
+          if (dimension > 1 &&
+              action->action->precondition_kind == decl::Action::Dynamic &&
+              can_batch (pos, pos + dimension))
+            {
+              action->batch_size = dimension;
+            }
+        }
+    }
+}
+
 void
 Composer::dump_graphviz () const
 {
@@ -85,6 +85,16 @@ struct Action : public Node
   }
   NodesType nodes;
   NodesType precondition_nodes;
+  // True if the result of the precondition can be cached.
+  bool precondition_cacheable;
+  // False if the precondition was false and nothing it reads has changed since.
+  mutable bool possibly_enabled;
+  // Cached preconditions that must be reevaluated after this action executes.
+  ActionsType invalidates;
+  // The number of actions, starting with this one, whose preconditions
+  // are evaluated together before their bodies run.  1 if this action
+  // runs by itself.
+  size_t batch_size;
 private:
   static std::string getname (Instance* instance,
                               decl::Action* action,
@@ -115,6 +125,8 @@ struct Reaction : public Node
   long const iota;
   NodesType nodes;
   std::vector<PushPort*> push_ports;
+  // Cached preconditions that must be reevaluated after this reaction executes.
+  ActionsType invalidates;
 private:
   static std::string getname (Instance* instance,
                               decl::Reaction* reaction,
@@ -183,6 +195,9 @@ struct PullPort : public Node
   GettersType getters;
 };
 
+// Mark the actions so their preconditions are reevaluated.
+void invalidate (const ActionsType& actions);
+
 // Instantiates components and bindings and checks the resulting composition.
 class Composer
 {
@@ -190,6 +205,8 @@ public:
   void enumerate_instances (ast::Node* node);
   void elaborate ();
   void analyze ();
+  // Group the actions of dimensioned action declarations into batches.
+  void batch_actions ();
 
   typedef std::map<size_t, Instance*> InstancesType;
   typedef std::map<size_t, PushPort*> PushPortsType;
@@ -236,6 +253,7 @@ private:
   void elaborate_getters ();
   void elaborate_bindings ();
   void compute_dependent_instances ();
+  void compute_invalidations ();
   void check_structure ();
   void compute_instance_sets ();
 };
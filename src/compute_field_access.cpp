@@ -0,0 +1,477 @@
+#include "compute_field_access.hpp"
+
+#include "node.hpp"
+#include "node_visitor.hpp"
+#include "node_cast.hpp"
+#include "symbol_cast.hpp"
+#include "callable.hpp"
+#include "arch.hpp"
+
+namespace semantic
+{
+
+using namespace ast;
+using namespace decl;
+
+namespace
+{
+
+bool is_receiver (Node* node)
+{
+  IdentifierExpression* id = node_cast<IdentifierExpression> (node);
+  if (id == NULL)
+    {
+      return false;
+    }
+  Parameter* parameter = symbol_cast<Parameter> (id->symbol);
+  return parameter != NULL &&
+         (parameter->kind == Parameter::Receiver || parameter->kind == Parameter::Receiver_Duplicate) &&
+         parameter->type->underlying_type ()->to_pointer () != NULL;
+}
+
+// Returns true if node is the iota of a dimensioned action.
+bool is_iota (Node* node, const Symbol* iota)
+{
+  IdentifierExpression* id = node_cast<IdentifierExpression> (node);
+  return iota != NULL && id != NULL && id->symbol == iota;
+}
+
+// Compute the bytes of the component designated by node.
+// Returns false if node does not designate part of the component.
+// If node is part of an array element, the range is the whole array
+// (whole is set) and unit_size is the size of the element if iota
+// selects it or 0.
+bool receiver_range (Node* node, const Symbol* iota, size_t& offset, size_t& size, size_t& unit_size, bool& whole)
+{
+  Select* select = node_cast<Select> (node);
+  if (select != NULL && select->field != NULL)
+    {
+      if (is_receiver (select->base))
+        {
+          offset = 0;
+          unit_size = 0;
+          whole = false;
+        }
+      else if (select->base->eval.type->underlying_type ()->to_pointer () != NULL ||
+               !receiver_range (select->base, iota, offset, size, unit_size, whole))
+        {
+          return false;
+        }
+      if (!whole)
+        {
+          offset += arch::offset (select->field);
+          size = arch::size (select->field->type);
+        }
+      return true;
+    }
+
+  Index* index = node_cast<Index> (node);
+  if (index != NULL && index->array_type != NULL)
+    {
+      if (!receiver_range (index->base, iota, offset, size, unit_size, whole))
+        {
+          return false;
+        }
+      if (!whole)
+        {
+          // The whole array.
+          unit_size = is_iota (index->index, iota) ? arch::unit_size (index->array_type) : 0;
+          whole = true;
+        }
+      return true;
+    }
+
+  Dereference* dereference = node_cast<Dereference> (node);
+  if (dereference != NULL && is_receiver (dereference->child))
+    {
+      offset = 0;
+      size = arch::size (dereference->eval.type);
+      unit_size = 0;
+      whole = false;
+      return true;
+    }
+
+  return false;
+}
+
+bool receiver_range (Node* node, size_t& offset, size_t& size)
+{
+  size_t unit_size;
+  bool whole;
+  return receiver_range (node, NULL, offset, size, unit_size, whole);
+}
+
+// Returns true if node designates a variable in the frame.
+bool is_local (Node* node)
+{
+  if (node_cast<IdentifierExpression> (node) != NULL)
+    {
+      return true;
+    }
+
+  Select* select = node_cast<Select> (node);
+  if (select != NULL)
+    {
+      return select->base->eval.type->underlying_type ()->to_pointer () == NULL && is_local (select->base);
+    }
+
+  Index* index = node_cast<Index> (node);
+  if (index != NULL)
+    {
+      return index->array_type != NULL && is_local (index->base);
+    }
+
+  return false;
+}
+
+// Collect the fields read by a precondition.
+// The precondition is cacheable if it only reads fields of the component.
+struct ReadVisitor : public ast::DefaultNodeVisitor
+{
+  FieldSet& reads;
+  const Symbol* const iota;
+  bool cacheable;
+
+  ReadVisitor (FieldSet& r, const Symbol* i) : reads (r), iota (i), cacheable (true) { }
+
+  void default_action (Node& node)
+  {
+    cacheable = false;
+  }
+
+  bool read (Node& node)
+  {
+    size_t offset, size, unit_size;
+    bool whole;
+    if (receiver_range (&node, iota, offset, size, unit_size, whole))
+      {
+        reads.insert (offset, size, unit_size);
+        return true;
+      }
+    return false;
+  }
+
+  void visit (Literal& node)
+  { }
+
+  void visit (TypeExpression& node)
+  { }
+
+  void visit (IdentifierExpression& node)
+  {
+    // The receiver and iota are fixed for an action.
+  }
+
+  // Check the indices in the path to a field.
+  void check_indices (Node* node)
+  {
+    Select* select = node_cast<Select> (node);
+    if (select != NULL)
+      {
+        check_indices (select->base);
+        return;
+      }
+    Index* index = node_cast<Index> (node);
+    if (index != NULL)
+      {
+        check_indices (index->base);
+        index->index->accept (*this);
+      }
+  }
+
+  void visit (Select& node)
+  {
+    if (!read (node))
+      {
+        cacheable = false;
+        return;
+      }
+    check_indices (node.base);
+  }
+
+  void visit (Index& node)
+  {
+    if (!read (node))
+      {
+        cacheable = false;
+        return;
+      }
+    check_indices (node.base);
+    node.index->accept (*this);
+  }
+
+  void visit (Dereference& node)
+  {
+    if (!read (node))
+      {
+        cacheable = false;
+      }
+  }
+
+  void visit (ast::UnaryArithmetic& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void visit (ast::BinaryArithmetic& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void visit (Conversion& node)
+  {
+    node.argument->accept (*this);
+  }
+
+  void visit (Call& node)
+  {
+    if (node.expression->eval.expression_kind == TypeExpressionKind)
+      {
+        // Conversion.
+        node.arguments->at (0)->accept (*this);
+        return;
+      }
+    cacheable = false;
+  }
+};
+
+typedef std::map<const type::NamedType*, FieldSet> AddressTakenType;
+
+// Collect the fields written by a body.
+// Writes through pointers are recorded in indirect and are resolved with
+// the fields whose address is taken anywhere in the component.
+struct WriteVisitor : public ast::DefaultNodeVisitor
+{
+  FieldSet& writes;
+  bool indirect;
+  FieldSet& address_taken;
+  size_t const component_size;
+  const Symbol* const iota;
+
+  WriteVisitor (FieldSet& w, FieldSet& at, size_t cs, const Symbol* i)
+    : writes (w)
+    , indirect (false)
+    , address_taken (at)
+    , component_size (cs)
+    , iota (i)
+  { }
+
+  void default_action (Node& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void write (Node* node)
+  {
+    size_t offset, size, unit_size;
+    bool whole;
+    if (receiver_range (node, iota, offset, size, unit_size, whole))
+      {
+        writes.insert (offset, size, unit_size);
+      }
+    else if (!is_local (node))
+      {
+        indirect = true;
+      }
+  }
+
+  void take_address (Node* node)
+  {
+    size_t offset, size;
+    if (receiver_range (node, offset, size))
+      {
+        writes.insert (offset, size);
+        address_taken.insert (offset, size);
+      }
+  }
+
+  void visit (Assign& node)
+  {
+    node.visit_children (*this);
+    write (node.left);
+  }
+
+  void visit (AddAssign& node)
+  {
+    node.visit_children (*this);
+    write (node.left);
+  }
+
+  void visit (SubtractAssign& node)
+  {
+    node.visit_children (*this);
+    write (node.left);
+  }
+
+  void visit (IncrementDecrement& node)
+  {
+    node.visit_children (*this);
+    write (node.child);
+  }
+
+  void visit (AddressOf& node)
+  {
+    node.visit_children (*this);
+    take_address (node.child);
+  }
+
+  void visit (IdentifierExpression& node)
+  {
+    // Uses of the receiver other than selecting a field or dereferencing
+    // let it escape.
+    if (is_receiver (&node))
+      {
+        writes.insert (0, component_size);
+        address_taken.insert (0, component_size);
+      }
+  }
+
+  void visit (Select& node)
+  {
+    if (!is_receiver (node.base))
+      {
+        node.base->accept (*this);
+      }
+  }
+
+  void visit (Dereference& node)
+  {
+    if (!is_receiver (node.child))
+      {
+        node.child->accept (*this);
+      }
+  }
+
+  void visit (Call& node)
+  {
+    node.visit_children (*this);
+
+    if (node.expression->eval.expression_kind == TypeExpressionKind)
+      {
+        return;
+      }
+
+    if (node.method_type != NULL &&
+        node.method_type->receiver_parameter->type->underlying_type ()->to_pointer () != NULL)
+      {
+        Node* base = node_cast<Select> (node.expression)->base;
+        if (base->eval.type->underlying_type ()->to_pointer () != NULL)
+          {
+            if (is_receiver (base))
+              {
+                writes.insert (0, component_size);
+                address_taken.insert (0, component_size);
+              }
+            else
+              {
+                indirect = true;
+              }
+          }
+        else
+          {
+            // The address of the base is taken implicitly.
+            take_address (base);
+          }
+      }
+
+    // The callee may write through pointers in the arguments.
+    for (List::ConstIterator pos = node.arguments->begin (), limit = node.arguments->end ();
+         pos != limit;
+         ++pos)
+      {
+        if ((*pos)->eval.type->contains_pointer ())
+          {
+            indirect = true;
+          }
+      }
+  }
+};
+
+struct Record
+{
+  FieldSet* writes;
+  bool indirect;
+  const type::NamedType* type;
+};
+
+struct Visitor : public ast::DefaultNodeVisitor
+{
+  AddressTakenType address_taken;
+  std::vector<Record> records;
+
+  void default_action (Node& node)
+  { }
+
+  void visit (SourceFile& node)
+  {
+    node.top_level_decl_list->accept (*this);
+  }
+
+  void visit (TopLevelDeclList& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void body (Node* body, const type::NamedType* type, FieldSet* writes, const Symbol* iota = NULL)
+  {
+    FieldSet scratch;
+    WriteVisitor v (writes ? *writes : scratch, address_taken[type], arch::size (type), iota);
+    body->accept (v);
+    if (writes != NULL)
+      {
+        Record r = { writes, v.indirect, type };
+        records.push_back (r);
+      }
+  }
+
+  void visit (ast::InitDecl& node)
+  {
+    body (node.body, node.initializer->named_type, NULL);
+  }
+
+  void visit (ast::GetterDecl& node)
+  {
+    body (node.body, node.getter->named_type, NULL);
+  }
+
+  void visit (ast::MethodDecl& node)
+  {
+    body (node.body, node.method->named_type, NULL);
+  }
+
+  void visit (ast::ActionDecl& node)
+  {
+    decl::Action* action = node.action;
+    const Symbol* iota = action->dimension () != -1 ? action->iota_parameter () : NULL;
+    ReadVisitor rv (action->precondition_reads, iota);
+    node.precondition->accept (rv);
+    action->precondition_cacheable = rv.cacheable;
+    body (node.body, action->named_type, &action->writes, iota);
+  }
+
+  void visit (ast::ReactionDecl& node)
+  {
+    body (node.body, node.reaction->named_type, &node.reaction->writes);
+  }
+};
+
+}
+
+void compute_field_access (ast::Node* root)
+{
+  Visitor visitor;
+  root->accept (visitor);
+  // Writes through pointers may reach any field whose address was taken.
+  for (std::vector<Record>::const_iterator pos = visitor.records.begin (),
+       limit = visitor.records.end ();
+       pos != limit;
+       ++pos)
+    {
+      if (pos->indirect)
+        {
+          pos->writes->insert (visitor.address_taken[pos->type]);
+        }
+    }
+}
+
+}
@@ -0,0 +1,13 @@
+#ifndef RC_SRC_COMPUTE_FIELD_ACCESS_HPP
+#define RC_SRC_COMPUTE_FIELD_ACCESS_HPP
+
+#include "types.hpp"
+
+namespace semantic
+{
+// Compute the fields read by the precondition of each action and the
+// fields written by each action and reaction.
+void compute_field_access (ast::Node* root);
+}
+
+#endif // RC_SRC_COMPUTE_FIELD_ACCESS_HPP
@@ -73,6 +73,12 @@ void ExecutorBase::checked_for_writability (runtime::FileDescriptor* fd) { }
 
 bool ExecutorBase::execute (const composition::Action* action)
 {
+  if (action->precondition_cacheable && !action->possibly_enabled)
+    {
+      // Nothing read by the precondition has changed since it was false.
+      return false;
+    }
+
   Event* e = begin_event ();
   bool enabled = runtime::enabled (*this, action->instance->component, action->action, action->iota);
   end_event (e, enabled ? Event::Precondition_True : Event::Precondition_False, action);
@@ -82,23 +88,69 @@ bool ExecutorBase::execute (const composition::Action* action)
       e = begin_event ();
       runtime::execute_no_check (*this, action->instance->component, action->action, action->iota);
       end_event (e, Event::Action, action);
+      composition::invalidate (action->invalidates);
+    }
+  else
+    {
+      action->possibly_enabled = false;
     }
 
   return enabled;
 }
 
+bool ExecutorBase::execute (const composition::Action* const* actions, size_t count)
+{
+  enabled_.resize (count);
+  bool evaluate = false;
+  for (size_t idx = 0; idx != count; ++idx)
+    {
+      // Skip the preconditions that are known to be false.
+      enabled_[idx] = actions[idx]->possibly_enabled;
+      evaluate = evaluate || enabled_[idx];
+    }
+  if (!evaluate)
+    {
+      return false;
+    }
+
+  const composition::Action* first = actions[0];
+  Event* e = begin_event ();
+  runtime::enabled (*this, first->instance->component, first->action, first->iota, count, &enabled_[0]);
+  bool retval = false;
+  for (size_t idx = 0; idx != count; ++idx)
+    {
+      retval = retval || enabled_[idx];
+    }
+  end_event (e, retval ? Event::Precondition_True : Event::Precondition_False, first);
+
+  for (size_t idx = 0; idx != count; ++idx)
+    {
+      if (enabled_[idx])
+        {
+          execute_no_check (actions[idx]);
+        }
+      else
+        {
+          actions[idx]->possibly_enabled = false;
+        }
+    }
+
+  return retval;
+}
+
 void ExecutorBase::execute_no_check (const composition::Action* action)
 {
   Event* e = begin_event ();
   runtime::execute_no_check (*this, action->instance->component, action->action, action->iota);
   end_event (e, Event::Action, action);
+  composition::invalidate (action->invalidates);
 }
 
-bool ExecutorBase::collect_garbage (ComponentInfoBase* info)
+bool ExecutorBase::collect_garbage (ComponentInfoBase* info, bool compact)
 {
   this->current_info (info);
   Event* e = begin_event ();
-  bool gc = this->heap ()->collect_garbage ();
+  bool gc = compact ? this->heap ()->compact () : this->heap ()->collect_garbage ();
   end_event (e, gc ? Event::Garbage_Collection_True : Event::Garbage_Collection_False, info);
   return gc;
 }
@@ -39,8 +39,12 @@ struct ExecutorBase
   virtual void checked_for_readability (FileDescriptor* fd);
   virtual void checked_for_writability (FileDescriptor* fd);
   bool execute (const composition::Action* action);
+  // Execute a batch of actions for consecutive iota values.
+  // Returns true if any action was enabled.
+  bool execute (const composition::Action* const* actions, size_t count);
   void execute_no_check (const composition::Action* action);
-  bool collect_garbage (ComponentInfoBase* info);
+  // Collect the heap of the instance, compacting it if compact is true.
+  bool collect_garbage (ComponentInfoBase* info, bool compact = false);
   void fini (FILE* profile_out, size_t thread);
 
 private:
@@ -75,6 +79,8 @@ private:
   EventsType events_;
   size_t event_idx_;
   bool event_full_;
+  // The preconditions of the batch being executed.
+  std::vector<char> enabled_;
 };
 
 ComponentInfoBase* component_to_info (component_t* component);
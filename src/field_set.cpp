@@ -0,0 +1,83 @@
+#include "field_set.hpp"
+
+namespace semantic
+{
+
+void
+FieldSet::insert (size_t offset, size_t size)
+{
+  insert (offset, size, 0);
+}
+
+void
+FieldSet::insert (size_t offset, size_t size, size_t unit_size)
+{
+  if (size != 0)
+    {
+      ranges.push_back (std::make_pair (offset, size));
+      unit_sizes.push_back (unit_size);
+    }
+}
+
+void
+FieldSet::insert (const FieldSet& other)
+{
+  ranges.insert (ranges.end (), other.ranges.begin (), other.ranges.end ());
+  unit_sizes.insert (unit_sizes.end (), other.unit_sizes.begin (), other.unit_sizes.end ());
+}
+
+bool
+FieldSet::empty () const
+{
+  return ranges.empty ();
+}
+
+bool
+FieldSet::intersects (size_t address, const FieldSet& other, size_t other_address) const
+{
+  for (RangesType::const_iterator pos = ranges.begin (), limit = ranges.end ();
+       pos != limit;
+       ++pos)
+    {
+      const size_t begin = address + pos->first;
+      const size_t end = begin + pos->second;
+      for (RangesType::const_iterator opos = other.ranges.begin (), olimit = other.ranges.end ();
+           opos != olimit;
+           ++opos)
+        {
+          const size_t other_begin = other_address + opos->first;
+          const size_t other_end = other_begin + opos->second;
+          if (begin < other_end && other_begin < end)
+            {
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+bool
+FieldSet::intersects_other_iota (const FieldSet& other) const
+{
+  for (size_t idx = 0; idx != ranges.size (); ++idx)
+    {
+      const size_t begin = ranges[idx].first;
+      const size_t end = begin + ranges[idx].second;
+      for (size_t oidx = 0; oidx != other.ranges.size (); ++oidx)
+        {
+          const size_t other_begin = other.ranges[oidx].first;
+          const size_t other_end = other_begin + other.ranges[oidx].second;
+          if (begin < other_end && other_begin < end &&
+              // Different iota values select different elements of the same array.
+              !(unit_sizes[idx] != 0 &&
+                ranges[idx] == other.ranges[oidx] &&
+                unit_sizes[idx] == other.unit_sizes[oidx]))
+            {
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+}
@@ -0,0 +1,37 @@
+#ifndef RC_SRC_FIELD_SET_HPP
+#define RC_SRC_FIELD_SET_HPP
+
+#include "types.hpp"
+
+namespace semantic
+{
+
+// A set of byte ranges relative to the start of a component.
+struct FieldSet
+{
+  // Offset and size.
+  typedef std::pair<size_t, size_t> RangeType;
+  typedef std::vector<RangeType> RangesType;
+
+  void insert (size_t offset, size_t size);
+  // Insert the element of an array selected by iota.  offset and size
+  // describe the whole array.
+  void insert (size_t offset, size_t size, size_t unit_size);
+  void insert (const FieldSet& other);
+  bool empty () const;
+  // Returns true if this set placed at address and other placed at
+  // other_address have a byte in common.
+  bool intersects (size_t address, const FieldSet& other, size_t other_address) const;
+  // Returns true if this set for one iota value and other for a
+  // different iota value have a byte in common.  Both sets are in the
+  // same component.
+  bool intersects_other_iota (const FieldSet& other) const;
+
+  RangesType ranges;
+  // The element size of each range selected by iota or 0.
+  std::vector<size_t> unit_sizes;
+};
+
+}
+
+#endif // RC_SRC_FIELD_SET_HPP
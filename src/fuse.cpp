@@ -0,0 +1,161 @@
+#include "fuse.hpp"
+
+#include "operation.hpp"
+
+namespace code
+{
+using namespace runtime;
+
+Fuser::Fuser (bool enabled)
+  : enabled_ (enabled)
+{ }
+
+Operation*
+Fuser::load (Operation* child, const type::Type* type)
+{
+  if (enabled_)
+    {
+      const Reference* r = dynamic_cast<const Reference*> (child);
+      if (r != NULL)
+        {
+          fired ("Load (Reference) -> LoadLocal");
+          return make_load_local (r->offset, arch::size (type));
+        }
+      const FieldAddress* f = dynamic_cast<const FieldAddress*> (child);
+      if (f != NULL)
+        {
+          fired ("Load (FieldAddress) -> LoadField");
+          return make_load_field (f->offset, f->field, arch::size (type));
+        }
+    }
+  return make_load (child, type);
+}
+
+Operation*
+Fuser::select (Operation* base, ptrdiff_t offset)
+{
+  if (enabled_)
+    {
+      const Reference* r = dynamic_cast<const Reference*> (base);
+      if (r != NULL)
+        {
+          fired ("Select (Reference) -> Reference");
+          return new Reference (r->offset + offset);
+        }
+      const LoadLocal* l = dynamic_cast<const LoadLocal*> (base);
+      if (l != NULL)
+        {
+          assert (l->size == sizeof (void*));
+          fired ("Select (LoadLocal) -> FieldAddress");
+          return new FieldAddress (l->offset, offset);
+        }
+      const FieldAddress* f = dynamic_cast<const FieldAddress*> (base);
+      if (f != NULL)
+        {
+          fired ("Select (FieldAddress) -> FieldAddress");
+          return new FieldAddress (f->offset, f->field + offset);
+        }
+    }
+  return new Select (base, offset);
+}
+
+Operation*
+Fuser::assign (Operation* left, Operation* right, const type::Type* type)
+{
+  if (enabled_)
+    {
+      const LiteralBase* l = dynamic_cast<const LiteralBase*> (right);
+      if (l != NULL && l->size == arch::size (type))
+        {
+          fired ("Assign (..., Literal) -> AssignLiteral");
+          return new AssignLiteral (left, l);
+        }
+      const Reference* r = dynamic_cast<const Reference*> (left);
+      if (r != NULL)
+        {
+          fired ("Assign (Reference, ...) -> AssignLocal");
+          return make_assign_local (r->offset, right, arch::size (type));
+        }
+    }
+  return make_assign (left, right, type);
+}
+
+Operation*
+Fuser::increment (Operation* child, const type::Type* type)
+{
+  if (enabled_)
+    {
+      const Reference* r = dynamic_cast<const Reference*> (child);
+      if (r != NULL)
+        {
+          fired ("Increment (Reference) -> IncrementLocal");
+          return make_increment_local (r->offset, type);
+        }
+      const FieldAddress* f = dynamic_cast<const FieldAddress*> (child);
+      if (f != NULL)
+        {
+          fired ("Increment (FieldAddress) -> IncrementField");
+          return make_increment_field (f->offset, f->field, type);
+        }
+    }
+  return make_increment (child, type);
+}
+
+Operation*
+Fuser::decrement (Operation* child, const type::Type* type)
+{
+  if (enabled_)
+    {
+      const Reference* r = dynamic_cast<const Reference*> (child);
+      if (r != NULL)
+        {
+          fired ("Decrement (Reference) -> DecrementLocal");
+          return make_decrement_local (r->offset, type);
+        }
+      const FieldAddress* f = dynamic_cast<const FieldAddress*> (child);
+      if (f != NULL)
+        {
+          fired ("Decrement (FieldAddress) -> DecrementField");
+          return make_decrement_field (f->offset, f->field, type);
+        }
+    }
+  return make_decrement (child, type);
+}
+
+Operation*
+Fuser::binary (Operation* op)
+{
+  if (enabled_)
+    {
+      const BinaryBase* b = dynamic_cast<const BinaryBase*> (op);
+      if (b != NULL)
+        {
+          Operation* f = b->fuse_literal ();
+          if (f != NULL)
+            {
+              fired ("Binary (..., Literal) -> BinaryLiteral");
+              return f;
+            }
+        }
+    }
+  return op;
+}
+
+void
+Fuser::report (std::ostream& out) const
+{
+  for (CountsType::const_iterator pos = counts_.begin (), limit = counts_.end ();
+       pos != limit;
+       ++pos)
+    {
+      out << pos->second << ' ' << pos->first << '\n';
+    }
+}
+
+void
+Fuser::fired (const std::string& pattern)
+{
+  ++counts_[pattern];
+}
+
+}
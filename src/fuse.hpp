@@ -0,0 +1,41 @@
+#ifndef RC_SRC_FUSE_HPP
+#define RC_SRC_FUSE_HPP
+
+#include <iostream>
+#include <string>
+
+#include "types.hpp"
+
+namespace code
+{
+
+// Builds operations and replaces common subtrees with fused operations.
+// Operations are built bottom-up so a fused child can enable the fusion of its parent.
+// Counts the number of times each pattern fired.
+class Fuser
+{
+public:
+  Fuser (bool enabled);
+
+  runtime::Operation* load (runtime::Operation* child, const type::Type* type);
+  runtime::Operation* select (runtime::Operation* base, ptrdiff_t offset);
+  runtime::Operation* assign (runtime::Operation* left, runtime::Operation* right, const type::Type* type);
+  runtime::Operation* increment (runtime::Operation* child, const type::Type* type);
+  runtime::Operation* decrement (runtime::Operation* child, const type::Type* type);
+  // Fuse a Binary with a literal right operand.
+  runtime::Operation* binary (runtime::Operation* op);
+
+  // Print the number of times each pattern fired.
+  void report (std::ostream& out) const;
+
+private:
+  void fired (const std::string& pattern);
+
+  bool const enabled_;
+  typedef std::map<std::string, size_t> CountsType;
+  CountsType counts_;
+};
+
+}
+
+#endif // RC_SRC_FUSE_HPP
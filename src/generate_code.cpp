@@ -1,5 +1,10 @@
 #include "generate_code.hpp"
 
+#include <error.h>
+#include <errno.h>
+
+#include <fstream>
+
 #include "node.hpp"
 #include "node_visitor.hpp"
 #include "node_cast.hpp"
@@ -8,6 +13,9 @@
 #include "symbol_visitor.hpp"
 #include "semantic.hpp"
 #include "operation.hpp"
+#include "fuse.hpp"
+#include "native.hpp"
+#include "symbol_cast.hpp"
 
 namespace  code
 {
@@ -17,18 +25,562 @@ using namespace type;
 using namespace semantic;
 using namespace decl;
 
-static Operation* load (Node* node, Operation* op)
+// Count the nodes in a subtree.
+struct SizeVisitor : public ast::DefaultNodeVisitor
+{
+  size_t size;
+
+  SizeVisitor () : size (0) { }
+
+  void default_action (Node& node)
+  {
+    ++size;
+    node.visit_children (*this);
+  }
+};
+
+// Returns the variable or parameter that node designates (possibly through
+// fields and array elements) or NULL.
+static const Symbol* root_symbol (Node* node)
+{
+  IdentifierExpression* id = node_cast<IdentifierExpression> (node);
+  if (id != NULL)
+    {
+      return id->symbol;
+    }
+  ast::Select* select = node_cast<ast::Select> (node);
+  if (select != NULL && select->base->eval.type->underlying_type ()->to_pointer () == NULL)
+    {
+      return root_symbol (select->base);
+    }
+  ast::Index* index = node_cast<ast::Index> (node);
+  if (index != NULL && index->array_type != NULL)
+    {
+      return root_symbol (index->base);
+    }
+  return NULL;
+}
+
+// Collect the variables and parameters whose address is taken.
+struct AddressTakenVisitor : public ast::DefaultNodeVisitor
+{
+  std::set<const Symbol*>& symbols;
+
+  AddressTakenVisitor (std::set<const Symbol*>& s) : symbols (s) { }
+
+  void default_action (Node& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void visit (AddressOf& node)
+  {
+    node.visit_children (*this);
+    symbols.insert (root_symbol (node.child));
+  }
+
+  void visit (Call& node)
+  {
+    node.visit_children (*this);
+    if (node.method_type != NULL &&
+        node.method_type->receiver_parameter->type->underlying_type ()->to_pointer () != NULL)
+      {
+        Node* base = node_cast<ast::Select> (node.expression)->base;
+        if (base->eval.type->underlying_type ()->to_pointer () == NULL)
+          {
+            symbols.insert (root_symbol (base));
+          }
+      }
+  }
+};
+
+// Determine if a subtree other than skip assigns symbol.
+struct AssignsVisitor : public ast::DefaultNodeVisitor
+{
+  const Symbol* const symbol;
+  const Node* const skip;
+  bool assigns;
+
+  AssignsVisitor (const Symbol* s, const Node* k) : symbol (s), skip (k), assigns (false) { }
+
+  void default_action (Node& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void check (Node& node, Node* target)
+  {
+    IdentifierExpression* id = node_cast<IdentifierExpression> (target);
+    if (&node != skip && id != NULL && id->symbol == symbol)
+      {
+        assigns = true;
+      }
+    node.visit_children (*this);
+  }
+
+  void visit (ast::Assign& node)
+  {
+    check (node, node.left);
+  }
+
+  void visit (ast::AddAssign& node)
+  {
+    check (node, node.left);
+  }
+
+  void visit (ast::SubtractAssign& node)
+  {
+    check (node, node.left);
+  }
+
+  void visit (ast::IncrementDecrement& node)
+  {
+    check (node, node.child);
+  }
+};
+
+// Objects larger than this are always allocated in the heap to keep
+// frames small.
+static const size_t stack_allocation_limit = 256;
+
+// Returns the variable or parameter whose pointee contains the object
+// that node designates or NULL.
+static const Symbol* pointee_symbol (Node* node)
 {
-  assert (node->eval.expression_kind != UnknownExpressionKind);
-  if (node->eval.expression_kind == VariableExpressionKind)
+  Dereference* deref = node_cast<Dereference> (node);
+  if (deref != NULL)
+    {
+      IdentifierExpression* id = node_cast<IdentifierExpression> (deref->child);
+      return id != NULL ? id->symbol : NULL;
+    }
+  ast::Select* select = node_cast<ast::Select> (node);
+  if (select != NULL)
+    {
+      if (select->base->eval.type->underlying_type ()->to_pointer () == NULL)
+        {
+          return pointee_symbol (select->base);
+        }
+      IdentifierExpression* id = node_cast<IdentifierExpression> (select->base);
+      return id != NULL ? id->symbol : NULL;
+    }
+  ast::Index* index = node_cast<ast::Index> (node);
+  if (index != NULL && index->array_type != NULL)
     {
-      return new Load (op, node->eval.type);
+      return pointee_symbol (index->base);
     }
-  return op;
+  return NULL;
 }
 
+// Collect the local variables initialized with a small object from new.
+struct NewVariableVisitor : public ast::DefaultNodeVisitor
+{
+  std::map<const Symbol*, Call*>& variables;
+
+  NewVariableVisitor (std::map<const Symbol*, Call*>& v) : variables (v) { }
+
+  void default_action (Node& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void visit (Var& node)
+  {
+    node.visit_children (*this);
+    for (size_t idx = 0; idx != node.expressions->size (); ++idx)
+      {
+        Call* call = node_cast<Call> (node.expressions->at (idx));
+        if (call != NULL &&
+            dynamic_cast<const New*> (call->polymorphic_function) != NULL)
+          {
+            const type::Type* type = call->arguments->at (0)->eval.type;
+            if (type->to_heap () == NULL &&
+                arch::size (type) <= stack_allocation_limit)
+              {
+                variables[node.symbols[idx]] = call;
+              }
+          }
+      }
+  }
+};
+
+// Determine which of a set of variables and parameters may let the
+// object they point to outlive the frame.  Dereferencing a symbol and
+// selecting its fields is safe.  Passing it to a function or method
+// whose parameter does not escape is safe.  Every other use escapes.
+struct EscapeVisitor : public ast::DefaultNodeVisitor
+{
+  typedef std::map<const Parameter*, bool> ParametersType;
+
+  const std::set<const Symbol*>& symbols;
+  // Parameters known to escape.  Parameters being analyzed are
+  // recorded as escaping so recursion is conservative.
+  ParametersType& parameters;
+  std::set<const Symbol*> escaped;
+
+  EscapeVisitor (const std::set<const Symbol*>& s, ParametersType& p) : symbols (s), parameters (p) { }
+
+  void default_action (Node& node)
+  {
+    node.visit_children (*this);
+  }
+
+  void escape (const Symbol* symbol)
+  {
+    if (symbol != NULL && symbols.count (symbol) != 0)
+      {
+        escaped.insert (symbol);
+      }
+  }
+
+  // Returns the symbol if node is the bare name of one being tracked.
+  const Symbol* tracked (Node* node) const
+  {
+    IdentifierExpression* id = node_cast<IdentifierExpression> (node);
+    return id != NULL && symbols.count (id->symbol) != 0 ? id->symbol : NULL;
+  }
+
+  void visit (IdentifierExpression& node)
+  {
+    escape (node.symbol);
+  }
+
+  void visit (Dereference& node)
+  {
+    if (tracked (node.child) == NULL)
+      {
+        node.visit_children (*this);
+      }
+  }
+
+  void visit (ast::Select& node)
+  {
+    if (tracked (node.base) == NULL ||
+        node.base->eval.type->underlying_type ()->to_pointer () == NULL)
+      {
+        node.visit_children (*this);
+      }
+  }
+
+  void visit (AddressOf& node)
+  {
+    escape (pointee_symbol (node.child));
+    node.visit_children (*this);
+  }
+
+  void visit (ast::IndexSlice& node)
+  {
+    escape (pointee_symbol (node.base));
+    node.visit_children (*this);
+  }
+
+  void visit (Call& node)
+  {
+    const decl::Function* function = dynamic_cast<const decl::Function*> (node.callable);
+    const decl::Method* method = dynamic_cast<const decl::Method*> (node.callable);
+    Node* body = NULL;
+    if (node.function_type != NULL && function != NULL)
+      {
+        body = function->functiondecl->body;
+      }
+    else if (node.method_type != NULL && method != NULL)
+      {
+        body = method->methoddecl->body;
+      }
+
+    ast::Select* select = node_cast<ast::Select> (node.expression);
+    if (node.function_type == NULL && select != NULL)
+      {
+        // The receiver may be passed by address.
+        escape (tracked (select->base));
+        escape (pointee_symbol (select->base));
+      }
+    node.expression->accept (*this);
+
+    const decl::ParameterList* list = node.callable != NULL ? node.callable->parameter_list () : NULL;
+    for (size_t idx = 0; idx != node.arguments->size (); ++idx)
+      {
+        Node* arg = node.arguments->at (idx);
+        if (body == NULL ||
+            list->is_variadic () ||
+            list->size () != node.arguments->size () ||
+            tracked (arg) == NULL ||
+            parameter_escapes (list->at (idx), body))
+          {
+            arg->accept (*this);
+          }
+      }
+  }
+
+  bool parameter_escapes (const Parameter* parameter, Node* body)
+  {
+    ParametersType::const_iterator pos = parameters.find (parameter);
+    if (pos != parameters.end ())
+      {
+        return pos->second;
+      }
+    parameters[parameter] = true;
+    std::set<const Symbol*> s;
+    s.insert (parameter);
+    EscapeVisitor v (s, parameters);
+    body->accept (v);
+    parameters[parameter] = !v.escaped.empty ();
+    return parameters[parameter];
+  }
+};
+
+// Collect the calls to new whose result can be allocated in the frame.
+static void find_stack_allocations (Node* root, std::set<const Node*>& calls)
+{
+  std::map<const Symbol*, Call*> variables;
+  NewVariableVisitor nv (variables);
+  root->accept (nv);
+
+  std::set<const Symbol*> symbols;
+  for (std::map<const Symbol*, Call*>::const_iterator pos = variables.begin (), limit = variables.end ();
+       pos != limit;
+       ++pos)
+    {
+      symbols.insert (pos->first);
+    }
+  EscapeVisitor::ParametersType parameters;
+  EscapeVisitor ev (symbols, parameters);
+  root->accept (ev);
+
+  for (std::map<const Symbol*, Call*>::const_iterator pos = variables.begin (), limit = variables.end ();
+       pos != limit;
+       ++pos)
+    {
+      if (ev.escaped.count (pos->first) == 0)
+        {
+          calls.insert (pos->second);
+        }
+    }
+}
+
+// Get the value of an integer constant.
+static bool constant_value (const Node* node, long& value)
+{
+  if (!node->eval.value.present || !node->eval.type->is_typed_integer ())
+    {
+      return false;
+    }
+  value = node->eval.value.to_int (node->eval.type);
+  return true;
+}
+
+// The values of an integer variable over a region of code.
+// Either low <= v < high or low <= v < len (length).
+struct Range
+{
+  Range () : low (0), high (0), length (NULL) { }
+  Range (long l, long h) : low (l), high (h), length (NULL) { }
+  long low;
+  long high;
+  const Symbol* length;
+};
+
 struct CodeGenVisitor : public ast::DefaultNodeVisitor
 {
+  const Options& options;
+  Fuser fuser;
+  NativeModule* native;
+  // Memory model of the frame being generated or NULL if there is none.
+  MemoryModel* memory_model;
+  // Added to the offsets of symbols when generating an inlined body.
+  ptrdiff_t frame_bias;
+  // First free offset after the locals and inlined frames.
+  ptrdiff_t inline_offset;
+  // Callables whose bodies are being generated.
+  std::set<const Callable*> active;
+  // Variables and parameters whose address is taken.
+  std::set<const Symbol*> address_taken;
+  // Calls to new whose result never leaves the frame.
+  std::set<const Node*> stack_allocated;
+  // Ranges of loop variables in the code being generated.
+  typedef std::map<const Symbol*, Range> RangesType;
+  RangesType ranges;
+  // The statement before the statement being generated or NULL.
+  Node* previous_statement;
+
+  CodeGenVisitor (const Options& a_options)
+    : options (a_options)
+    , fuser (a_options.fuse)
+    , native (NULL)
+    , memory_model (NULL)
+    , frame_bias (0)
+    , inline_offset (0)
+    , previous_statement (NULL)
+  { }
+
+  // Start generating the body of callable in its own frame.
+  void enter_frame (const Callable* callable, MemoryModel& mm)
+  {
+    memory_model = &mm;
+    frame_bias = 0;
+    inline_offset = sizeof (void*) + mm.locals_size_on_stack ();
+    active.clear ();
+    active.insert (callable);
+  }
+
+  void leave_frame ()
+  {
+    memory_model = NULL;
+    active.clear ();
+  }
+
+  ptrdiff_t offset (const Symbol* symbol) const
+  {
+    return symbol->offset () + frame_bias;
+  }
+
+  // Generate the body of a small function, method, or getter in the
+  // current frame.  Returns NULL if the call cannot be inlined.
+  Operation* inline_call (const Callable* callable, Operation* receiver, Operation* arguments)
+  {
+    if (options.inline_threshold == 0 ||
+        memory_model == NULL ||
+        active.count (callable) != 0 ||
+        callable->parameter_list ()->is_variadic ())
+      {
+        return NULL;
+      }
+
+    const decl::Function* function = dynamic_cast<const decl::Function*> (callable);
+    const decl::Method* method = dynamic_cast<const decl::Method*> (callable);
+    const decl::Getter* getter = dynamic_cast<const decl::Getter*> (callable);
+    Node* body;
+    if (function != NULL)
+      {
+        body = function->functiondecl->body;
+      }
+    else if (method != NULL)
+      {
+        body = method->methoddecl->body;
+      }
+    else if (getter != NULL)
+      {
+        body = getter->getterdecl->body;
+      }
+    else
+      {
+        return NULL;
+      }
+
+    SizeVisitor sv;
+    body->accept (sv);
+    if (sv.size > options.inline_threshold)
+      {
+        return NULL;
+      }
+
+    // The inlined frame holds the return value, arguments, a fake
+    // instruction pointer and base pointer, and the locals of the callee.
+    const MemoryModel& mm = callable->memory_model;
+    const ptrdiff_t frame_offset = inline_offset;
+    const ptrdiff_t bias = frame_offset - mm.arguments_offset ();
+    const ptrdiff_t saved_bias = frame_bias;
+    inline_offset += static_cast<ptrdiff_t> (sizeof (void*) + mm.locals_size_on_stack ()) - mm.arguments_offset ();
+    memory_model->locals_reserve (inline_offset - sizeof (void*));
+    frame_bias = bias;
+    active.insert (callable);
+
+    body->accept (*this);
+    Operation* b = body->operation;
+    if (getter != NULL)
+      {
+        b = new SetRestoreCurrentInstance (b, mm.receiver_offset () + bias);
+      }
+
+    active.erase (callable);
+    frame_bias = saved_bias;
+    inline_offset = frame_offset;
+
+    return new InlineCall (callable, receiver, arguments, compile (b), frame_offset);
+  }
+
+  // Allocate a cleared object of type after the locals and inlined frames.
+  Operation* stack_new (const type::Type* type)
+  {
+    const ptrdiff_t offset = inline_offset;
+    inline_offset += util::align_up (arch::size (type), arch::stack_alignment ());
+    memory_model->locals_reserve (inline_offset - sizeof (void*));
+    return new StackNewOp (offset, arch::size (type));
+  }
+
+  Operation* method_call (const Callable* callable, Operation* receiver, Operation* arguments)
+  {
+    Operation* op = inline_call (callable, receiver, arguments);
+    return op ? op : new MethodCall (callable, receiver, arguments);
+  }
+
+  Operation* load (Node* node, Operation* op)
+  {
+    assert (node->eval.expression_kind != UnknownExpressionKind);
+    if (node->eval.expression_kind == VariableExpressionKind)
+      {
+        return fuser.load (op, node->eval.type);
+      }
+    return op;
+  }
+
+  // Replace an expression with a known value by a literal.
+  bool fold (Node& node)
+  {
+    if (options.fold &&
+        node.eval.value.present &&
+        is_literal_type (node.eval.type))
+      {
+        node.operation = make_literal (node.eval.type, node.eval.value);
+        return true;
+      }
+    return false;
+  }
+
+  // Reduce true && x, x && true, false || x, and x || false to x.
+  // The static evaluator already folds false && x and true || x.
+  Operation* fold_logical (ast::BinaryArithmetic& node, Operation* left, Operation* right)
+  {
+    if (!options.fold)
+      {
+        return NULL;
+      }
+    bool identity;
+    if (dynamic_cast<const semantic::LogicAnd*> (node.polymorphic_function) != NULL)
+      {
+        identity = true;
+      }
+    else if (dynamic_cast<const semantic::LogicOr*> (node.polymorphic_function) != NULL)
+      {
+        identity = false;
+      }
+    else
+      {
+        return NULL;
+      }
+    if (node.left->eval.value.present && node.left->eval.value.bool_value == identity)
+      {
+        return right;
+      }
+    if (node.right->eval.value.present && node.right->eval.value.bool_value == identity)
+      {
+        return left;
+      }
+    return NULL;
+  }
+
+  Operation* compile (Operation* op)
+  {
+    if (native != NULL)
+      {
+        return native->add (op);
+      }
+    if (options.bytecode)
+      {
+        return new Bytecode (op);
+      }
+    return op;
+  }
+
   void default_action (Node& node)
   {
     AST_NOT_REACHED (node);
@@ -51,6 +603,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
   void visit (ast::InstanceDecl& node)
   {
+    leave_frame ();
     node.arguments->accept (*this);
     node.operation = new MethodCall (node.symbol->initializer (), new runtime::Instance (node.symbol), node.arguments->operation);
   }
@@ -62,52 +615,75 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
   void visit (ast::InitDecl& node)
   {
+    enter_frame (node.initializer, node.initializer->memory_model);
     node.body->accept (*this);
-    node.initializer->operation = new SetRestoreCurrentInstance (node.body->operation, node.initializer->memory_model.receiver_offset ());
+    node.initializer->operation = new SetRestoreCurrentInstance (compile (node.body->operation), node.initializer->memory_model.receiver_offset ());
   }
 
   void visit (ast::GetterDecl& node)
   {
+    enter_frame (node.getter, node.getter->memory_model);
     node.body->accept (*this);
-    node.getter->operation = new SetRestoreCurrentInstance (node.body->operation, node.getter->memory_model.receiver_offset ());
+    node.getter->operation = new SetRestoreCurrentInstance (compile (node.body->operation), node.getter->memory_model.receiver_offset ());
   }
 
   void visit (ast::ActionDecl& node)
   {
+    enter_frame (node.action, node.action->memory_model);
+    if (node.action->dimension () != -1)
+      {
+        ranges[node.action->iota_parameter ()] = Range (0, node.action->dimension ());
+      }
     node.precondition->accept (*this);
     Operation* p = node.precondition->operation;
     p = load (node.precondition, p);
-    node.precondition->operation = new SetRestoreCurrentInstance (p, node.action->memory_model.receiver_offset ());
+    node.precondition->operation = new SetRestoreCurrentInstance (compile (p), node.action->memory_model.receiver_offset ());
     node.body->accept (*this);
-    node.body->operation = new SetRestoreCurrentInstance (node.body->operation, node.action->memory_model.receiver_offset ());
+    node.body->operation = new SetRestoreCurrentInstance (compile (node.body->operation), node.action->memory_model.receiver_offset ());
   }
 
   void visit (ast::ReactionDecl& node)
   {
+    enter_frame (node.reaction, node.reaction->memory_model);
+    if (node.reaction->dimension () != -1)
+      {
+        ranges[node.reaction->iota ()] = Range (0, node.reaction->dimension ());
+      }
     node.body->accept (*this);
-    node.reaction->operation = new SetRestoreCurrentInstance (node.body->operation, node.reaction->memory_model.receiver_offset ());
+    node.reaction->operation = new SetRestoreCurrentInstance (compile (node.body->operation), node.reaction->memory_model.receiver_offset ());
   }
 
   void visit (ast::BindDecl& node)
   {
+    leave_frame ();
     node.body->accept (*this);
   }
 
   void visit (ast::FunctionDecl& node)
   {
+    enter_frame (node.symbol, node.symbol->memory_model);
     node.body->accept (*this);
-    node.symbol->operation = node.body->operation;
+    node.symbol->operation = compile (node.body->operation);
   }
 
   void visit (ast::MethodDecl& node)
   {
+    enter_frame (node.method, node.method->memory_model);
     node.body->accept (*this);
-    node.method->operation = node.body->operation;
+    node.method->operation = compile (node.body->operation);
   }
 
   void visit (StatementList& node)
   {
-    node.visit_children (*this);
+    previous_statement = NULL;
+    for (List::ConstIterator pos = node.begin (), limit = node.end ();
+         pos != limit;
+         ++pos)
+      {
+        Node* statement = *pos;
+        statement->accept (*this);
+        previous_statement = statement;
+      }
     ListOperation* op = new ListOperation ();
     for (List::ConstIterator pos = node.begin (), limit = node.end ();
          pos != limit;
@@ -117,6 +693,11 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
           {
             op->list.push_back ((*pos)->operation);
           }
+        if (options.fold && node_cast<ast::Return> (*pos) != NULL)
+          {
+            // The remaining statements are unreachable.
+            break;
+          }
       }
     node.operation = op;
   }
@@ -138,7 +719,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
     node.visit_children (*this);
     Operation* c = node.child->operation;
     c = load (node.child, c);
-    node.operation = new runtime::Return (c, node.return_symbol);
+    node.operation = new runtime::Return (c, offset (node.return_symbol), arch::size (node.return_symbol->type));
   }
 
   void visit (ast::If& node)
@@ -163,9 +744,178 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
       }
   }
 
+  // Find a variable v in a loop of the form
+  //   v = c; while v < n { ...; v++; }
+  // that is only changed by the final increment.  n is a constant or
+  // len (s) for a slice s that is not assigned in the loop.
+  const Symbol* induction_variable (ast::While& node, Range& range) const
+  {
+    ast::BinaryArithmetic* condition = node_cast<ast::BinaryArithmetic> (node.condition);
+    if (condition == NULL || condition->polymorphic_function != &less_than_temp)
+      {
+        return NULL;
+      }
+    IdentifierExpression* id = node_cast<IdentifierExpression> (condition->left);
+    if (id == NULL ||
+        (symbol_cast<Variable> (id->symbol) == NULL && symbol_cast<Parameter> (id->symbol) == NULL) ||
+        !id->eval.type->is_typed_integer () ||
+        address_taken.count (id->symbol) != 0)
+      {
+        return NULL;
+      }
+    const Symbol* symbol = id->symbol;
+
+    // Upper bound.
+    long value;
+    if (constant_value (condition->right, value))
+      {
+        if (value < 0)
+          {
+            return NULL;
+          }
+        range.high = value;
+      }
+    else
+      {
+        Call* call = node_cast<Call> (condition->right);
+        if (call == NULL ||
+            dynamic_cast<const Len*> (call->polymorphic_function) == NULL ||
+            call->arguments->at (0)->eval.type->underlying_type ()->to_slice () == NULL)
+          {
+            return NULL;
+          }
+        IdentifierExpression* s = node_cast<IdentifierExpression> (call->arguments->at (0));
+        if (s == NULL || address_taken.count (s->symbol) != 0)
+          {
+            return NULL;
+          }
+        AssignsVisitor v (s->symbol, NULL);
+        node.body->accept (v);
+        if (v.assigns)
+          {
+            return NULL;
+          }
+        range.length = s->symbol;
+      }
+
+    // Lower bound.
+    if (id->eval.type->is_typed_unsigned_integer ())
+      {
+        range.low = 0;
+      }
+    else if (!initial_value (symbol, range.low))
+      {
+        return NULL;
+      }
+
+    // The only change is the final increment.
+    List* body = node_cast<List> (node.body);
+    if (body == NULL || body->begin () == body->end ())
+      {
+        return NULL;
+      }
+    IncrementDecrement* increment = node_cast<IncrementDecrement> (body->at (body->size () - 1));
+    if (increment == NULL ||
+        increment->kind != IncrementDecrement::Increment ||
+        node_cast<IdentifierExpression> (increment->child) == NULL ||
+        node_cast<IdentifierExpression> (increment->child)->symbol != symbol)
+      {
+        increment = NULL;
+      }
+    AssignsVisitor v (symbol, increment);
+    node.body->accept (v);
+    if (v.assigns)
+      {
+        return NULL;
+      }
+
+    return symbol;
+  }
+
+  // Get the constant assigned to symbol by the previous statement.
+  bool initial_value (const Symbol* symbol, long& value) const
+  {
+    Var* var = node_cast<Var> (previous_statement);
+    if (var != NULL)
+      {
+        for (size_t idx = 0; idx != var->symbols.size (); ++idx)
+          {
+            if (var->symbols[idx] == symbol)
+              {
+                if (var->expressions->size () == 0)
+                  {
+                    value = 0;
+                    return true;
+                  }
+                return constant_value (var->expressions->at (idx), value);
+              }
+          }
+        return false;
+      }
+
+    ast::Assign* assign = node_cast<ast::Assign> (previous_statement);
+    if (assign != NULL)
+      {
+        IdentifierExpression* id = node_cast<IdentifierExpression> (assign->left);
+        return id != NULL && id->symbol == symbol && constant_value (assign->right, value);
+      }
+
+    return false;
+  }
+
+  // Returns true if the index of node is known to be in bounds.
+  bool in_bounds (ast::Index& node) const
+  {
+    if (!options.hoist)
+      {
+        return false;
+      }
+
+    long value;
+    if (node.array_type != NULL && constant_value (node.index, value))
+      {
+        return value >= 0 && value < node.array_type->dimension;
+      }
+
+    IdentifierExpression* id = node_cast<IdentifierExpression> (node.index);
+    if (id == NULL)
+      {
+        return false;
+      }
+    RangesType::const_iterator pos = ranges.find (id->symbol);
+    if (pos == ranges.end () || pos->second.low < 0)
+      {
+        return false;
+      }
+    const Range& range = pos->second;
+    if (node.array_type != NULL)
+      {
+        return range.length == NULL && range.high <= node.array_type->dimension;
+      }
+    IdentifierExpression* base = node_cast<IdentifierExpression> (node.base);
+    return range.length != NULL && base != NULL && base->symbol == range.length;
+  }
+
   void visit (ast::While& node)
   {
+    Range range;
+    const Symbol* symbol = induction_variable (node, range);
+    if (symbol != NULL)
+      {
+        ranges[symbol] = range;
+      }
     node.visit_children (*this);
+    if (symbol != NULL)
+      {
+        ranges.erase (symbol);
+      }
+    if (options.fold &&
+        node.condition->eval.value.present &&
+        !node.condition->eval.value.bool_value)
+      {
+        node.operation = new Noop ();
+        return;
+      }
     Operation* c = node.condition->operation;
     c = load (node.condition, c);
     node.operation = new runtime::While (c, node.body->operation);
@@ -173,8 +923,10 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
   void visit (ast::ForIota& node)
   {
+    ranges[node.symbol] = Range (0, node.limit_value);
     node.body->accept (*this);
-    node.operation = new runtime::ForIota (node.symbol, node.limit_value, node.body->operation);
+    ranges.erase (node.symbol);
+    node.operation = new runtime::ForIota (offset (node.symbol), node.limit_value, compile (node.body->operation));
   }
 
   void visit (Var& node)
@@ -188,7 +940,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
              ++pos)
           {
             Variable* symbol = *pos;
-            op->list.push_back (new Clear (symbol->offset (), arch::size (symbol->type)));
+            op->list.push_back (new Clear (offset (symbol), arch::size (symbol->type)));
           }
       }
     else
@@ -203,7 +955,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
             Variable* symbol = node.symbols[idx];
             Operation* right = (*pos)->operation;
             right = load (*pos, right);
-            op->list.push_back (new runtime::Assign (new Reference (symbol->offset ()), right, symbol->type));
+            op->list.push_back (fuser.assign (new Reference (offset (symbol)), right, symbol->type));
           }
       }
     node.operation = op;
@@ -220,7 +972,19 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
     Operation* left = node.left->operation;
     Operation* right = node.right->operation;
     right = load (node.right, right);
-    node.operation = new runtime::Assign (left, right, node.left->eval.type);
+    const type::Type* type = node.left->eval.type;
+    if (options.write_barrier &&
+        type->contains_pointer () &&
+        dynamic_cast<const Reference*> (left) == NULL)
+      {
+        // The destination may be an object that a generational or
+        // incremental collection has already scanned.
+        node.operation = new BarrierAssign (left, right, type);
+      }
+    else
+      {
+        node.operation = fuser.assign (left, right, type);
+      }
   }
 
   void visit (AddAssign& node)
@@ -238,10 +1002,10 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
     switch (node.kind)
       {
       case IncrementDecrement::Increment:
-        node.operation = make_increment (node.child->operation, node.child->eval.type);
+        node.operation = fuser.increment (node.child->operation, node.child->eval.type);
         break;
       case IncrementDecrement::Decrement:
-        node.operation = make_decrement (node.child->operation, node.child->eval.type);
+        node.operation = fuser.decrement (node.child->operation, node.child->eval.type);
         break;
       }
   }
@@ -252,13 +1016,13 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
     node.body->accept (*this);
     Operation* root = node.argument->operation;
     root = load (node.argument, root);
-    node.operation = new runtime::Change (root, node.root_symbol->offset (), node.body->operation);
+    node.operation = new runtime::Change (root, offset (node.root_symbol), compile (node.body->operation));
   }
 
   void visit (ast::Activate& node)
   {
     node.visit_children (*this);
-    Operation* b = node.body->operation;
+    Operation* b = compile (node.body->operation);
     // Add to the schedule.
     if (node.mutable_phase_access == AccessWrite ||
         (node.in_action && !node.arguments->empty ()))
@@ -296,6 +1060,10 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
     assert (node.expression->eval.expression_kind != UnknownExpressionKind);
     if (node.expression->eval.expression_kind == TypeExpressionKind)
       {
+        if (fold (node))
+          {
+            return;
+          }
         node.arguments->at (0)->accept (*this);
         Operation* o = node.arguments->at (0)->operation;
         o = load (node.arguments->at (0), o);
@@ -307,6 +1075,12 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
     if (node.polymorphic_function != NULL)
       {
+        if (memory_model != NULL && stack_allocated.count (&node) != 0)
+          {
+            node.operation = stack_new (node.arguments->at (0)->eval.type);
+            return;
+          }
+
         ExpressionValueList arguments;
         List* args = node.arguments;
         for (List::ConstIterator pos = args->begin (), limit = args->end ();
@@ -322,7 +1096,11 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
       {
         if (node.function_type)
           {
-            node.operation = new FunctionCall (node.callable, node.arguments->operation);
+            node.operation = inline_call (node.callable, NULL, node.arguments->operation);
+            if (node.operation == NULL)
+              {
+                node.operation = new FunctionCall (node.callable, node.arguments->operation);
+              }
           }
         else if (node.method_type || node.initializer_type || node.getter_type || node.reaction_type)
           {
@@ -341,12 +1119,12 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
                     if (sb->eval.expression_kind == VariableExpressionKind)
                       {
                         // Got a pointer.  Expecting a pointer.  Load the pointer.
-                        node.operation = new MethodCall (node.callable, new Load (sb->operation, sb->eval.type), node.arguments->operation);
+                        node.operation = method_call (node.callable, fuser.load (sb->operation, sb->eval.type), node.arguments->operation);
                       }
                     else
                       {
                         // Got a pointer.  Expecting a pointer.  Pointer is alreay loaded.
-                        node.operation = new MethodCall (node.callable, sb->operation, node.arguments->operation);
+                        node.operation = method_call (node.callable, sb->operation, node.arguments->operation);
                       }
                   }
                 else
@@ -355,7 +1133,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
                     assert (sb->eval.expression_kind != UnknownExpressionKind);
                     if (sb->eval.expression_kind == VariableExpressionKind)
                       {
-                        node.operation = new MethodCall (node.callable, new Load (new Load (sb->operation, sb->eval.type), mb->receiver_parameter->type), node.arguments->operation);
+                        node.operation = method_call (node.callable, fuser.load (fuser.load (sb->operation, sb->eval.type), mb->receiver_parameter->type), node.arguments->operation);
                       }
                     else
                       {
@@ -371,7 +1149,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
                     if (sb->eval.expression_kind == VariableExpressionKind)
                       {
                         // Got a value.  Expected a pointer.  Use variable as pointer.
-                        node.operation = new MethodCall (node.callable, sb->operation, node.arguments->operation);
+                        node.operation = method_call (node.callable, sb->operation, node.arguments->operation);
                       }
                     else
                       {
@@ -384,7 +1162,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
                     if (sb->eval.expression_kind == VariableExpressionKind)
                       {
                         // Got a value.  Expected a value.  Load the variable.
-                        node.operation = new MethodCall (node.callable, new Load (sb->operation, sb->eval.type), node.arguments->operation);
+                        node.operation = method_call (node.callable, fuser.load (sb->operation, sb->eval.type), node.arguments->operation);
                       }
                     else
                       {
@@ -420,6 +1198,10 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
   void visit (Conversion& node)
   {
+    if (fold (node))
+      {
+        return;
+      }
     node.argument->accept (*this);
     Operation* o = node.argument->operation;
     o = load (node.argument, o);
@@ -459,9 +1241,9 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
     struct Visitor : public ConstSymbolVisitor
     {
-      IdentifierExpression& node;
+      const CodeGenVisitor& cgv;
       Operation* op;
-      Visitor (IdentifierExpression& n) : node (n), op (NULL) { }
+      Visitor (const CodeGenVisitor& c) : cgv (c), op (NULL) { }
       void default_action (const Symbol& s)
       {
         NOT_REACHED;
@@ -469,12 +1251,12 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
       void visit (const Parameter& s)
       {
-        op = new Reference (s.offset ());
+        op = new Reference (cgv.offset (&s));
       }
 
       void visit (const Variable& s)
       {
-        op = new Reference (s.offset ());
+        op = new Reference (cgv.offset (&s));
       }
 
       void visit (const NamedType& s)
@@ -482,7 +1264,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
         op = new Noop ();
       }
     };
-    Visitor v (node);
+    Visitor v (*this);
     node.symbol->accept (v);
     node.operation = v.op;
   }
@@ -510,7 +1292,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
             assert (node.base->eval.expression_kind != UnknownExpressionKind);
             if (node.base->eval.expression_kind == VariableExpressionKind)
               {
-                node.operation = new runtime::Select (new Load (node.base->operation, node.base->eval.type), arch::offset (node.field));
+                node.operation = fuser.select (fuser.load (node.base->operation, node.base->eval.type), arch::offset (node.field));
               }
             else
               {
@@ -522,7 +1304,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
             assert (node.base->eval.expression_kind != UnknownExpressionKind);
             if (node.base->eval.expression_kind == VariableExpressionKind)
               {
-                node.operation = new runtime::Select (node.base->operation, arch::offset (node.field));
+                node.operation = fuser.select (node.base->operation, arch::offset (node.field));
               }
             else
               {
@@ -552,7 +1334,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
         assert (node.base->eval.expression_kind != UnknownExpressionKind);
         if (node.base->eval.expression_kind == VariableExpressionKind)
           {
-            node.operation = new IndexArray (node.location, node.base->operation, index_op, node.array_type);
+            node.operation = new IndexArray (node.location, node.base->operation, index_op, node.array_type, !in_bounds (node));
           }
         else
           {
@@ -570,7 +1352,7 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
         assert (node.base->eval.expression_kind != UnknownExpressionKind);
         if (node.base->eval.expression_kind == VariableExpressionKind)
           {
-            node.operation = new runtime::IndexSlice (node.location, new Load (node.base->operation, node.slice_type), index_op, node.slice_type);
+            node.operation = new runtime::IndexSlice (node.location, fuser.load (node.base->operation, node.slice_type), index_op, node.slice_type, !in_bounds (node));
           }
         else
           {
@@ -685,7 +1467,11 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
         left = load (node.left, left);
         Operation* right = node.right->operation;
         right = load (node.right, right);
-        node.operation = node.polymorphic_function->generate_code (node.eval, arg_vals, new ListOperation (left, right));
+        node.operation = fold_logical (node, left, right);
+        if (node.operation == NULL)
+          {
+            node.operation = fuser.binary (node.polymorphic_function->generate_code (node.eval, arg_vals, new ListOperation (left, right)));
+          }
       }
   }
 
@@ -711,10 +1497,41 @@ struct CodeGenVisitor : public ast::DefaultNodeVisitor
 
 };
 
-void generate_code (ast::Node* root)
+void generate_code (ast::Node* root, const Options& options)
 {
-  CodeGenVisitor visitor;
+  CodeGenVisitor visitor (options);
+  if (!options.emit_cxx.empty () || options.native)
+    {
+      // Lives as long as the operations that refer to it.
+      visitor.native = new NativeModule ();
+    }
+  if (options.hoist)
+    {
+      AddressTakenVisitor v (visitor.address_taken);
+      root->accept (v);
+    }
+  if (options.stack_allocate)
+    {
+      find_stack_allocations (root, visitor.stack_allocated);
+    }
   root->accept (visitor);
+  if (!options.emit_cxx.empty ())
+    {
+      std::ofstream out (options.emit_cxx.c_str ());
+      visitor.native->write (out);
+      if (!out)
+        {
+          error (EXIT_FAILURE, errno, "Could not write %s", options.emit_cxx.c_str ());
+        }
+    }
+  if (options.native)
+    {
+      visitor.native->load ();
+    }
+  if (options.fusion_report)
+    {
+      visitor.fuser.report (std::cerr);
+    }
 }
 
 }
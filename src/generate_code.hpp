@@ -1,12 +1,51 @@
 #ifndef RC_SRC_GENERATE_CODE_HPP
 #define RC_SRC_GENERATE_CODE_HPP
 
+#include <string>
+
 #include "types.hpp"
 
 namespace code
 {
 
-void generate_code (ast::Node* root);
+struct Options
+{
+  Options ()
+    : bytecode (false)
+    , fuse (true)
+    , fusion_report (false)
+    , fold (true)
+    , inline_threshold (16)
+    , native (false)
+    , hoist (true)
+    , stack_allocate (true)
+    , write_barrier (false)
+  { }
+
+  // Translate bodies to bytecode instead of walking the operation tree.
+  bool bytecode;
+  // Replace common subtrees with fused operations.
+  bool fuse;
+  // Print the number of times each fusion pattern fired to stderr.
+  bool fusion_report;
+  // Replace constant expressions with literals and remove dead code.
+  bool fold;
+  // Inline functions, methods, and getters whose bodies have at most this
+  // many nodes.  Zero disables inlining.
+  size_t inline_threshold;
+  // Write bodies as C++ to this file if not empty.
+  std::string emit_cxx;
+  // Compile bodies to a shared object and run them natively.
+  bool native;
+  // Omit bounds checks for indices proved in range by loops.
+  bool hoist;
+  // Allocate objects from new in the frame when they cannot escape it.
+  bool stack_allocate;
+  // Call the write barrier after assignments that store pointers.
+  bool write_barrier;
+};
+
+void generate_code (ast::Node* root, const Options& options = Options ());
 }
 
 #endif // RC_SRC_GENERATE_CODE_HPP
@@ -1,7 +1,13 @@
 #include "heap.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <new>
 #include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "util.hpp"
 #include "type.hpp"
@@ -11,91 +17,579 @@
  A heap consists of a number of blocks.  A block represents a
  contiguous memory region.  The region is divided into equal-sized
  slots.  The block contains a set of bits for each slot.  Free slots
- are coalesced into chunks that are organized into a singly-linked
- list.  Allocations are performed using first-fit.
+ are coalesced into chunks that are organized into singly-linked
+ lists.  Small chunks are kept in a list per size so allocating a
+ small object pops a list.  Large chunks are kept in one list and
+ allocated using first-fit.
+
+ Small objects are allocated by bumping a pointer through a span of
+ free memory.  Only the beginning of each object is recorded when it
+ is allocated; the slots of the span are recorded as allocated in bulk
+ when the span is retired or a collection starts.  The storage of a
+ new block is zero so objects bumped from its first span, or allocated
+ at its beginning, are not cleared again.
+
+ Blocks are swept lazily.  A collection marks the reachable objects
+ and leaves every block unswept.  The allocator sweeps one block at a
+ time when the free lists cannot satisfy a request, and a collection
+ finishes sweeping before it starts marking.  A slot in an unswept
+ block is allocated only if it is marked.
+
+ An object may be allocated with a pointer map derived from its type.
+ An object without pointers is marked but never scanned.  An object
+ with pointers keeps its pointer map in its last word and only the
+ words named by the map are followed.  Other objects, and roots, are
+ scanned conservatively.
+
+ A heap may keep a young generation.  Marks are sticky: sweeping
+ leaves the marks of the survivors, which are then old, and objects
+ allocated afterwards are young.  A minor collection marks from the
+ roots and from the old objects on dirty cards, and stops at marked
+ objects, so its cost is proportional to the surviving young objects
+ and not to the whole heap.  A card covers a fixed number of bytes of a
+ block and is dirtied by the write barrier when a pointer is stored on
+ it.  Old objects are only reclaimed by a full collection, which
+ resets the marks first.  A full collection is triggered when the old
+ objects have doubled since the last full collection.
+
+ A collection may be incremental.  It finishes sweeping, resets the
+ marks for a full collection, marks, and rescans, and each call works
+ in units until its pause budget is spent and resumes at the next
+ call.  A unit is a slice of a block's slots or cards, a block on the
+ work list, or a scan of the roots, so a call overruns its budget by
+ at most one unit.  While marking, objects are allocated marked and
+ scanned with their cards dirty, and the write barrier dirties the
+ cards of stores.  The collection finishes when a scan of the roots
+ finds nothing new and no card is dirty, so pointers stored while
+ marking are not lost.  If the mutator keeps dirtying cards, the
+ rescan ignores the budget after a fixed number of passes.
+
+ The children of a heap are disjoint so they are collected
+ independently.  With helper threads, the children are queued as a
+ batch and the helpers and the collecting thread claim them one at a
+ time.  The collecting thread waits for the batch before it returns.
+
+ A heap may be compacted.  A compaction is a full collection that
+ pins the objects referenced by conservatively scanned words, which
+ may not be pointers, and then copies the other marked objects of
+ blocks that are less than half full into a new block.  The first word
+ of each old copy forwards to the new copy, and the pointers named by
+ the pointer maps of the marked objects are updated.  The old copies
+ are unmarked so the sparse blocks are released by the sweep.
 
  A slot must be at least the size of a chunk.
+
+ The storage of a block is a whole number of pages so a page belongs
+ to at most one block.  A global page map records the block of every
+ page in use and the block records its heap.  Finding the block for an
+ address is a constant-time lookup in the page map.  Merging a heap
+ relabels its blocks and splices its lists without touching the page
+ map, so the cost is proportional to the number of blocks in the
+ merged heap, which is small since block sizes grow geometrically.
+
+ Free blocks are kept in a pool shared by all heaps so that creating
+ and destroying heaps does not go to the system allocator.  A pooled
+ block has a power of two number of pages and its storage is zeroed
+ before it is reused.  Large blocks are mapped directly and their
+ pages are returned to the system while they are in the pool.
 */
 
 // Size of a slot in bytes.
 #define SLOT_SIZE (2 * sizeof (void*))
 // Keep this many bits per slot.
-#define BITS_PER_SLOT 4
+#define BITS_PER_SLOT 8
 
 #define OBJECT 0x01
 #define ALLOCATED 0x02
 #define MARK 0x04
 #define SCANNED 0x08
+// The object contains no pointers.
+#define NOSCAN 0x10
+// The last word of the object is its pointer map.
+#define TYPED 0x20
+// The object is referenced by a conservatively scanned word.
+#define PINNED 0x40
+// The object has moved and its first word is its new address.
+#define FORWARDED 0x80
+
+// Size of a card in bytes.
+#define CARD_SHIFT 9
+#define CARD_SIZE (static_cast<size_t> (1) << CARD_SHIFT)
+#define SLOTS_PER_CARD (CARD_SIZE / SLOT_SIZE)
+// Bytes allocated in a generational heap between minor collections.
+#define NURSERY_SIZE (64 * 1024)
+// Slots scanned, swept or reset in a block before an incremental
+// collection checks its deadline.
+#define SCAN_SLOTS 4096
+// Cards scanned in a block before an incremental collection checks
+// its deadline.
+#define SCAN_CARDS (SCAN_SLOTS / SLOTS_PER_CARD)
+// Passes over the cards while rescanning before the rest of the
+// rescan ignores the deadline.  The mutator may dirty cards as fast
+// as they are scanned.
+#define RESCAN_PASSES 16
+
+// Size of a page in bytes.
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (static_cast<size_t> (1) << PAGE_SHIFT)
+// The page map is a radix tree with three levels that covers 48 bits
+// of address space.
+#define LEVEL_BITS 12
+#define LEVEL_SIZE (static_cast<size_t> (1) << LEVEL_BITS)
+#define ADDRESS_BITS (PAGE_SHIFT + 3 * LEVEL_BITS)
+
+// Blocks with at least this many bytes are mapped directly.
+#define MAP_BLOCK_SIZE (64 * 1024)
+// Class k of the pool holds blocks of 2^k pages.
+#define POOL_CLASSES 9
+// Bytes of free blocks kept in each class of the pool.
+#define POOL_CLASS_BYTES (4 * 1024 * 1024)
 
 namespace runtime
 {
 
-Block* Block::make (size_t size)
+namespace
 {
-  size = util::align_up (size, SLOT_SIZE);
-  size_t bits_bytes = (size / SLOT_SIZE * BITS_PER_SLOT + BITS_PER_SLOT) / 8;
-  void* p = operator new (sizeof (Block) + bits_bytes);
-  Block* block = new (p) Block (bits_bytes);
-  block->begin_ = operator new (size);
-  memset (block->begin_, 0, size);
-  block->end_ = static_cast<char*> (block->begin_) + size;
-  return block;
+
+struct PageMapEntry
+{
+  Block* block;
+};
+
+struct PageMapLeaf
+{
+  PageMapEntry entries[LEVEL_SIZE];
+};
+
+struct PageMapInterior
+{
+  PageMapLeaf* leaves[LEVEL_SIZE];
+};
+
+// Interior nodes and leaves are never freed so lookups need no lock.
+// The lock serializes the creation of nodes.
+PageMapInterior* page_map[LEVEL_SIZE];
+pthread_mutex_t page_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Free blocks by size class.
+Block* block_pool[POOL_CLASSES];
+size_t block_pool_count[POOL_CLASSES];
+// Headers of deleted blocks.  Headers are never freed so a stale
+// block in the page map can be read safely.
+std::vector<void*> free_headers;
+pthread_mutex_t block_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Return the class of the pool for a block of size bytes or
+// POOL_CLASSES if the block is too large to be pooled.
+size_t pool_class (size_t size)
+{
+  size_t k = 0;
+  while (k != POOL_CLASSES && (PAGE_SIZE << k) < size)
+    {
+      ++k;
+    }
+  return k;
 }
 
-Block::~Block ()
+bool default_generational = false;
+GcPolicy default_policy;
+
+// Batches with unclaimed children.  Helpers, and collectors waiting
+// for their own batch, claim children from the first batch.
+ChildBatch* collector_queue;
+// Number of helper threads.
+size_t collector_count;
+pthread_mutex_t collector_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Signaled when a batch is queued.
+pthread_cond_t collector_work = PTHREAD_COND_INITIALIZER;
+// Signaled when the last child of a batch is collected.
+pthread_cond_t collector_done = PTHREAD_COND_INITIALIZER;
+
+bool past (const struct timespec* deadline)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return now.tv_sec > deadline->tv_sec ||
+         (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+PageMapEntry* page_map_entry (const void* address, bool create)
 {
-  if (left_)
+  size_t page = reinterpret_cast<size_t> (address) >> PAGE_SHIFT;
+  if (page >> (3 * LEVEL_BITS) != 0)
     {
-      delete left_;
+      // Not a user-space address.
+      return NULL;
+    }
+
+  PageMapInterior** interior = &page_map[page >> (2 * LEVEL_BITS)];
+  PageMapLeaf** leaf = NULL;
+  if (__atomic_load_n (interior, __ATOMIC_ACQUIRE) != NULL)
+    {
+      leaf = &(*interior)->leaves[(page >> LEVEL_BITS) & (LEVEL_SIZE - 1)];
+      if (__atomic_load_n (leaf, __ATOMIC_ACQUIRE) != NULL)
+        {
+          return &(*leaf)->entries[page & (LEVEL_SIZE - 1)];
+        }
+    }
+
+  if (!create)
+    {
+      return NULL;
+    }
+
+  pthread_mutex_lock (&page_map_mutex);
+  if (*interior == NULL)
+    {
+      PageMapInterior* i = new PageMapInterior ();
+      __atomic_store_n (interior, i, __ATOMIC_RELEASE);
     }
-  if (right_)
+  leaf = &(*interior)->leaves[(page >> LEVEL_BITS) & (LEVEL_SIZE - 1)];
+  if (*leaf == NULL)
     {
-      delete right_;
+      PageMapLeaf* l = new PageMapLeaf ();
+      __atomic_store_n (leaf, l, __ATOMIC_RELEASE);
     }
-  operator delete (begin_);
+  pthread_mutex_unlock (&page_map_mutex);
+  return &(*leaf)->entries[page & (LEVEL_SIZE - 1)];
+}
+
+}
+
+struct ChildBatch
+{
+  // The next child to claim or NULL.
+  Heap* next;
+  // Number of children claimed and not yet collected.
+  size_t pending;
+  const struct timespec* deadline;
+  // Some child collected garbage.
+  bool collected;
+  ChildBatch* link;
+};
+
+HeapStats::HeapStats ()
+  : heaps (0)
+  , allocated_bytes (0)
+  , live_bytes (0)
+  , used_bytes (0)
+  , blocks (0)
+  , block_bytes (0)
+  , collections (0)
+  , pause_ns (0)
+  , max_pause_ns (0)
+  , scanned_objects (0)
+{ }
+
+void HeapStats::add (const HeapStats& other)
+{
+  heaps += other.heaps;
+  allocated_bytes += other.allocated_bytes;
+  live_bytes += other.live_bytes;
+  used_bytes += other.used_bytes;
+  blocks += other.blocks;
+  block_bytes += other.block_bytes;
+  collections += other.collections;
+  pause_ns += other.pause_ns;
+  max_pause_ns = std::max (max_pause_ns, other.max_pause_ns);
+  scanned_objects += other.scanned_objects;
 }
 
-void Block::insert (Block** ptr, Block* block)
+double HeapStats::fragmentation () const
 {
-  assert (block->left_ == NULL);
-  assert (block->right_ == NULL);
-  Block* p = *ptr;
-  if (p == NULL)
+  if (block_bytes == 0 || used_bytes >= block_bytes)
     {
-      *ptr = block;
-      return;
+      return 0;
     }
+  return 1 - static_cast<double> (used_bytes) / block_bytes;
+}
+
+FreeLists::FreeLists ()
+{
+  clear ();
+}
+
+void FreeLists::insert (void* address, size_t size)
+{
+  assert (size % SLOT_SIZE == 0 && size != 0);
+
+  Chunk* c = static_cast<Chunk*> (address);
+  c->size = size;
+  size_t slots = size / SLOT_SIZE;
+  Chunk** list = slots <= SMALL_CLASSES ? &small_[slots - 1] : &large_;
+  c->next = *list;
+  *list = c;
+}
 
-  if (block->begin_ < p->begin_)
+void* FreeLists::remove (size_t size)
+{
+  assert (size % SLOT_SIZE == 0 && size != 0);
+
+  size_t slots = size / SLOT_SIZE;
+  Chunk** chunk = NULL;
+  if (slots <= SMALL_CLASSES)
     {
-      insert (&(p->left_), block);
+      // Fast path: a chunk of exactly the right size.
+      Chunk* c = small_[slots - 1];
+      if (c != NULL)
+        {
+          small_[slots - 1] = c->next;
+          return c;
+        }
+
+      // Split a larger small chunk.
+      for (size_t k = slots; k != SMALL_CLASSES && chunk == NULL; ++k)
+        {
+          if (small_[k] != NULL)
+            {
+              chunk = &small_[k];
+            }
+        }
+
+      // Every large chunk is large enough.
+      if (chunk == NULL && large_ != NULL)
+        {
+          chunk = &large_;
+        }
     }
   else
     {
-      insert (&(p->right_), block);
+      // First-fit.
+      for (chunk = &large_;
+           *chunk != NULL && (*chunk)->size < size;
+           chunk = &(*chunk)->next)
+        ;;
+    }
+
+  if (chunk == NULL || *chunk == NULL)
+    {
+      return NULL;
+    }
+
+  // Remove the chunk and reinsert the remainder.
+  Chunk* c = *chunk;
+  *chunk = c->next;
+  if (c->size != size)
+    {
+      insert (reinterpret_cast<char*> (c) + size, c->size - size);
     }
+
+  return c;
 }
 
-Block* Block::find (Block* block, void* address)
+void* FreeLists::remove_large (size_t* size)
 {
-  if (block == NULL)
+  Chunk* c = large_;
+  if (c == NULL)
     {
       return NULL;
     }
 
-  if (address >= block->begin_ && address < block->end_)
+  large_ = c->next;
+  *size = c->size;
+  return c;
+}
+
+static void append_list (Chunk** list, Chunk** other)
+{
+  if (*other == NULL)
+    {
+      return;
+    }
+
+  Chunk** ch;
+  for (ch = other; *ch != NULL; ch = &(*ch)->next)
+    ;;
+  *ch = *list;
+  *list = *other;
+  *other = NULL;
+}
+
+void FreeLists::append (FreeLists& other)
+{
+  for (size_t k = 0; k != SMALL_CLASSES; ++k)
+    {
+      append_list (&small_[k], &other.small_[k]);
+    }
+  append_list (&large_, &other.large_);
+}
+
+void FreeLists::clear ()
+{
+  for (size_t k = 0; k != SMALL_CLASSES; ++k)
+    {
+      small_[k] = NULL;
+    }
+  large_ = NULL;
+}
+
+#ifndef COVERAGE
+void FreeLists::dump () const
+{
+  for (size_t k = 0; k != SMALL_CLASSES; ++k)
+    {
+      for (Chunk* ch = small_[k]; ch != NULL; ch = ch->next)
+        {
+          printf ("%zd chunk=%p size=%zd next=%p\n", pthread_self(), ch, ch->size, ch->next);
+        }
+    }
+  for (Chunk* ch = large_; ch != NULL; ch = ch->next)
+    {
+      printf ("%zd chunk=%p size=%zd next=%p\n", pthread_self(), ch, ch->size, ch->next);
+    }
+}
+#endif
+
+Block* Block::make (Heap* heap, size_t size)
+{
+  size = util::align_up (size, PAGE_SIZE);
+  const size_t k = pool_class (size);
+  Block* block = NULL;
+  if (k != POOL_CLASSES)
+    {
+      // Round up to the class so the block can be pooled.
+      size = PAGE_SIZE << k;
+      pthread_mutex_lock (&block_pool_mutex);
+      block = block_pool[k];
+      if (block != NULL)
+        {
+          block_pool[k] = block->link_;
+          --block_pool_count[k];
+        }
+      pthread_mutex_unlock (&block_pool_mutex);
+    }
+
+  size_t bits_bytes = size / SLOT_SIZE * BITS_PER_SLOT / 8;
+  size_t card_bytes = size / CARD_SIZE;
+  if (block != NULL)
+    {
+      // Reuse the status bits and the zeroed storage.
+      block->clear (bits_bytes + card_bytes);
+    }
+  else
+    {
+      void* begin;
+      if (size >= MAP_BLOCK_SIZE)
+        {
+          // Mapped memory is zero.
+          begin = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+          if (begin == MAP_FAILED)
+            {
+              throw std::bad_alloc ();
+            }
+        }
+      else
+        {
+          if (posix_memalign (&begin, PAGE_SIZE, size) != 0)
+            {
+              throw std::bad_alloc ();
+            }
+          memset (begin, 0, size);
+        }
+      block = new Block (bits_bytes, card_bytes);
+      block->begin_ = begin;
+      block->end_ = static_cast<char*> (begin) + size;
+    }
+  __atomic_store_n (&block->heap_, heap, __ATOMIC_RELEASE);
+  block->map (true);
+  return block;
+}
+
+void* Block::operator new (size_t size)
+{
+  void* p = NULL;
+  pthread_mutex_lock (&block_pool_mutex);
+  if (!free_headers.empty ())
+    {
+      p = free_headers.back ();
+      free_headers.pop_back ();
+    }
+  pthread_mutex_unlock (&block_pool_mutex);
+  return p != NULL ? p : ::operator new (size);
+}
+
+void Block::operator delete (void* p)
+{
+  pthread_mutex_lock (&block_pool_mutex);
+  free_headers.push_back (p);
+  pthread_mutex_unlock (&block_pool_mutex);
+}
+
+void Block::release (Block* block)
+{
+  const size_t size = block->size ();
+  const size_t k = pool_class (size);
+  if (k == POOL_CLASSES)
+    {
+      delete block;
+      return;
+    }
+
+  block->map (false);
+  __atomic_store_n (&block->heap_, static_cast<Heap*> (NULL), __ATOMIC_RELEASE);
+  if (size >= MAP_BLOCK_SIZE)
+    {
+      // The pages are zero when they are touched again.
+      madvise (block->begin_, size, MADV_DONTNEED);
+    }
+  else
+    {
+      memset (block->begin_, 0, size);
+    }
+
+  pthread_mutex_lock (&block_pool_mutex);
+  if (block_pool_count[k] * size < POOL_CLASS_BYTES)
     {
-      return block;
+      block->link_ = block_pool[k];
+      block_pool[k] = block;
+      ++block_pool_count[k];
+      block = NULL;
     }
+  pthread_mutex_unlock (&block_pool_mutex);
+
+  delete block;
+}
 
-  if (address < block->begin_)
+Block::~Block ()
+{
+  map (false);
+  __atomic_store_n (&heap_, static_cast<Heap*> (NULL), __ATOMIC_RELEASE);
+  ::operator delete (bits_);
+  if (size () >= MAP_BLOCK_SIZE)
     {
-      return find (block->left_, address);
+      munmap (begin_, size ());
     }
   else
     {
-      return find (block->right_, address);
+      free (begin_);
+    }
+}
+
+void Block::map (bool flag)
+{
+  Block* block = flag ? this : NULL;
+  for (char* page = static_cast<char*> (begin_); page != end_; page += PAGE_SIZE)
+    {
+      PageMapEntry* entry = page_map_entry (page, true);
+      __atomic_store_n (&entry->block, block, __ATOMIC_RELEASE);
+    }
+}
+
+Block* Block::find (const Heap* heap, void* address)
+{
+  PageMapEntry* entry = page_map_entry (address, false);
+  if (entry == NULL || heap == NULL)
+    {
+      return NULL;
+    }
+  // The block may belong to a heap being used by another thread.
+  // Its header remains readable even if it is deleted.
+  Block* block = __atomic_load_n (&entry->block, __ATOMIC_ACQUIRE);
+  if (block == NULL || __atomic_load_n (&block->heap_, __ATOMIC_ACQUIRE) != heap)
+    {
+      return NULL;
     }
+  return block;
 }
 
 size_t Block::slot (void* address) const
@@ -107,40 +601,32 @@ size_t Block::slot (void* address) const
 
 void Block::set_bits (size_t slot, unsigned char mask)
 {
-  if (slot % 2 == 1)
-    {
-      mask <<= 4;
-    }
-  slot /= 2;
-
   bits_[slot] |= mask;
 }
 
 void Block::reset_bits (size_t slot, unsigned char mask)
 {
-  if (slot % 2 == 1)
-    {
-      mask <<= 4;
-    }
-  slot /= 2;
-
   bits_[slot] &= ~mask;
 }
 
 void Block::clear_bits (size_t slot)
 {
-  reset_bits (slot, 0x0F);
+  bits_[slot] = 0;
 }
 
 unsigned char Block::get_bits (size_t slot) const
 {
-  unsigned char retval = bits_[slot / 2];
-  if (slot % 2 == 1)
-    {
-      retval >>= 4;
-    }
+  return bits_[slot];
+}
 
-  return retval & 0x0F;
+// Return the slot after the object that contains slot.  The object
+// ends at the beginning of the next object or at an unallocated slot.
+size_t Block::object_end (size_t slot) const
+{
+  size_t max_slot = (static_cast<char*> (end_) - static_cast<char*> (begin_)) / SLOT_SIZE;
+  for (++slot; slot != max_slot && (get_bits (slot) & (OBJECT | ALLOCATED)) == ALLOCATED; ++slot)
+    ;
+  return slot;
 }
 
 void Block::allocate (void* address, size_t size)
@@ -157,27 +643,74 @@ void Block::allocate (void* address, size_t size)
     }
 }
 
-void Block::mark (void* address, Block** work_list)
+void Block::begin_object (void* address, const PointerMap* pointer_map)
+{
+  unsigned char bits = OBJECT;
+  if (pointer_map != NULL)
+    {
+      bits |= pointer_map->has_pointers () ? TYPED : NOSCAN;
+    }
+  set_bits (slot (address), bits);
+}
+
+void Block::allocate_span (void* address, size_t size)
+{
+  assert (size % SLOT_SIZE == 0);
+
+  size_t slot = this->slot (address);
+  size_t slot_end = slot + size / SLOT_SIZE;
+
+  for (; slot != slot_end; ++slot)
+    {
+      bits_[slot] |= ALLOCATED;
+    }
+}
+
+size_t Block::mark (void* address, Block** work_list, bool pin)
 {
   size_t slot = this->slot (address);
 
   // Get the bits.
   unsigned char bits = get_bits (slot);
 
+  if (pin && (bits & ALLOCATED) != 0)
+    {
+      size_t first;
+      for (first = slot; (get_bits (first) & OBJECT) == 0; --first)
+        ;
+      set_bits (first, PINNED);
+    }
+
   if ((bits & MARK) != 0)
     {
       // Already marked.
-      return;
+      return 0;
     }
 
   if ((bits & ALLOCATED) == 0)
     {
       // Not allocated.
-      return;
+      return 0;
     }
 
   marked_ = true;
 
+  // Search backward for the beginning of the object.
+  size_t first;
+  for (first = slot; (get_bits (first) & OBJECT) == 0; --first)
+    ;
+  size_t last = object_end (slot);
+
+  if ((get_bits (first) & NOSCAN) != 0)
+    {
+      // Nothing to scan.
+      for (size_t s = first; s != last; ++s)
+        {
+          set_bits (s, MARK | SCANNED);
+        }
+      return last - first;
+    }
+
   if (next_ == NULL)
     {
       // Not on the work list.
@@ -189,66 +722,78 @@ void Block::mark (void* address, Block** work_list)
         }
     }
 
-  // Mark backward until we find the beginning of the object.
-  size_t s;
-  for (s = slot; (get_bits (s) & OBJECT) == 0; --s)
+  for (size_t s = first; s != last; ++s)
     {
       set_bits (s, MARK);
     }
+  scan_begin_ = std::min (scan_begin_, first);
+  scan_end_ = std::max (scan_end_, last);
 
-  // Mark forward until we find the end of the object.
-  size_t max_slot = (static_cast<char*> (end_) - static_cast<char*> (begin_)) / SLOT_SIZE;
-  for (s = slot; s != max_slot && (get_bits (s) & ALLOCATED) != 0; ++s)
-    {
-      set_bits (s, MARK);
-    }
+  return last - first;
 }
 
-void Block::scan (Heap* heap, Block** work_list)
+void Block::scan (Heap* heap, Block** work_list, size_t limit)
 {
-  size_t slot;
-  size_t slots = (static_cast<char*> (end_) - static_cast<char*> (begin_)) / SLOT_SIZE;
-  for (slot = 0; slot != slots; ++slot)
+  // Only visit the slots marked since the last scan so that mark time
+  // is proportional to the marked objects and not to the size of the
+  // block times the number of times it is put on the work list.
+  size_t slot = scan_begin_;
+  size_t slots = scan_end_;
+  scan_begin_ = SIZE_MAX;
+  scan_end_ = 0;
+  if (limit < slots - std::min (slot, slots))
+    {
+      // Put the rest back on the work list.
+      scan_begin_ = slot + limit;
+      scan_end_ = slots;
+      slots = scan_begin_;
+      next_ = *work_list;
+      *work_list = this;
+      if (next_ == NULL)
+        {
+          next_ = reinterpret_cast<Block*> (1);
+        }
+    }
+  for (; slot < slots; ++slot)
     {
       unsigned char bits = get_bits (slot);
       if (((bits & MARK) != 0) &&
           ((bits & SCANNED) == 0))
         {
+          if ((bits & (OBJECT | TYPED)) == (OBJECT | TYPED))
+            {
+              // Follow the pointers in the pointer map.
+              size_t end = object_end (slot);
+              for (size_t s = slot; s != end; ++s)
+                {
+                  set_bits (s, SCANNED);
+                }
+              heap->scan_units (static_cast<char*> (begin_) + slot * SLOT_SIZE, static_cast<char*> (begin_) + end * SLOT_SIZE, work_list);
+              ++heap->stats_.scanned_objects;
+              slot = end - 1;
+              continue;
+            }
+
+          if ((bits & OBJECT) != 0)
+            {
+              ++heap->stats_.scanned_objects;
+            }
           set_bits (slot, SCANNED);
           heap->scan (static_cast<char*> (begin_) + slot * SLOT_SIZE, static_cast<char*> (begin_) + (slot + 1) * SLOT_SIZE, work_list);
         }
     }
 }
 
-Block* Block::remove_right_most (Block** b)
-{
-  Block* block = *b;
-  assert (block != NULL);
-
-  if (block->right_ == NULL)
-    {
-      // We are the right-most.
-      // Promote the left.
-      *b = block->left_;
-      block->left_ = NULL;
-      return block;
-    }
-  else
-    {
-      return remove_right_most (&block->right_);
-    }
-}
-
 #ifndef COVERAGE
 void Block::dump () const
 {
-  printf ("%zd block=%p begin=%p end=%p size=%zd left=%p right=%p\n", pthread_self(), this, begin_, end_, (char*)end_ - (char*)begin_, left_, right_);
+  printf ("%zd block=%p begin=%p end=%p size=%zd link=%p\n", pthread_self(), this, begin_, end_, (char*)end_ - (char*)begin_, link_);
   size_t slot;
   size_t slots = ((char*)end_ - (char*)begin_) / SLOT_SIZE;
   for (slot = 0; slot != slots; ++slot)
     {
       unsigned char bits = get_bits (slot);
-      printf ("%zd slot %zd bits=%x scanned=%d mark=%d object=%d allocated=%d\n", pthread_self(), slot, bits, (bits & SCANNED) != 0, (bits & MARK) != 0, (bits & OBJECT) != 0, (bits & ALLOCATED) != 0);
+      printf ("%zd slot %zd bits=%x typed=%d noscan=%d scanned=%d mark=%d object=%d allocated=%d\n", pthread_self(), slot, bits, (bits & TYPED) != 0, (bits & NOSCAN) != 0, (bits & SCANNED) != 0, (bits & MARK) != 0, (bits & OBJECT) != 0, (bits & ALLOCATED) != 0);
     }
   char** begin = (char**)begin_;
   char** end = (char**)end_;
@@ -256,416 +801,1486 @@ void Block::dump () const
     {
       printf ("%zd %p => %p\n", pthread_self(), begin, *begin);
     }
-  if (left_)
+}
+#endif
+
+bool Block::sweep (FreeLists* free_lists, bool sticky, size_t limit)
+{
+  if (sweep_slot_ == 0 && !marked_)
     {
-      left_->dump ();
+      swept_ = true;
+      return false;
     }
-  if (right_)
+
+  size_t slot = sweep_slot_;
+  size_t max_slot = ((char*)end_ - (char*)begin_) / SLOT_SIZE;
+  size_t stop = max_slot - slot > limit ? slot + limit : max_slot;
+  // A free run may continue from the last call.
+  size_t slot_begin = sweep_free_;
+  while (slot != stop)
     {
-      right_->dump ();
+      unsigned char bits = get_bits (slot);
+      if ((bits & MARK) != 0)
+        {
+          // Marked.
+          if (slot_begin != SIZE_MAX)
+            {
+              free_lists->insert ((char*)begin_ + slot_begin * SLOT_SIZE, (slot - slot_begin) * SLOT_SIZE);
+              slot_begin = SIZE_MAX;
+            }
+          if (!sticky)
+            {
+              reset_bits (slot, SCANNED | MARK);
+            }
+          ++slot;
+        }
+      else
+        {
+          // Not marked.
+          if (slot_begin == SIZE_MAX)
+            {
+              slot_begin = slot;
+            }
+          for (; slot != stop && (get_bits (slot) & MARK) == 0; ++slot)
+            {
+              clear_bits (slot);
+            }
+        }
     }
+
+  if (slot != max_slot)
+    {
+      // Resume at the next call.
+      sweep_slot_ = slot;
+      sweep_free_ = slot_begin;
+      return true;
+    }
+
+  if (slot_begin != SIZE_MAX)
+    {
+      free_lists->insert ((char*)begin_ + slot_begin * SLOT_SIZE, (slot - slot_begin) * SLOT_SIZE);
+    }
+  sweep_slot_ = 0;
+  sweep_free_ = SIZE_MAX;
+  swept_ = true;
+  marked_ = sticky;
+
+  return true;
+}
+
+void Block::reset_marks ()
+{
+  size_t slot = 0;
+  reset_marks (&slot, SIZE_MAX);
+}
+
+bool Block::reset_marks (size_t* slot, size_t limit)
+{
+  size_t max_slot = size () / SLOT_SIZE;
+  size_t stop = max_slot - *slot > limit ? *slot + limit : max_slot;
+  for (; *slot != stop; ++*slot)
+    {
+      reset_bits (*slot, SCANNED | MARK);
+    }
+  if (*slot != max_slot)
+    {
+      return false;
+    }
+  clean_cards ();
+  next_ = NULL;
+  scan_begin_ = SIZE_MAX;
+  scan_end_ = 0;
+  marked_ = false;
+  return true;
+}
+
+void Block::clean_cards ()
+{
+  if (dirty_)
+    {
+      memset (cards_, 0, size () / CARD_SIZE);
+      dirty_ = false;
+    }
+}
+
+void Block::allocate_marked (void* address, size_t size)
+{
+  size_t slot = this->slot (address);
+  size_t slot_end = slot + size / SLOT_SIZE;
+  for (; slot != slot_end; ++slot)
+    {
+      set_bits (slot, ALLOCATED | MARK | SCANNED);
+    }
+  marked_ = true;
+  dirty (address, size);
+}
+
+void Block::dirty (void* address, size_t size)
+{
+  size_t offset = static_cast<char*> (address) - static_cast<char*> (begin_);
+  size_t card_end = (offset + size - 1) / CARD_SIZE;
+  for (size_t card = offset / CARD_SIZE; card <= card_end; ++card)
+    {
+      cards_[card] = 1;
+    }
+  dirty_ = true;
+}
+
+bool Block::scan_cards (Heap* heap, Block** work_list, size_t* card, size_t limit)
+{
+  if (*card == 0)
+    {
+      if (!dirty_)
+        {
+          return true;
+        }
+      // Cards dirtied during the pass dirty the block again.
+      dirty_ = false;
+    }
+
+  size_t cards = size () / CARD_SIZE;
+  size_t stop = cards - *card > limit ? *card + limit : cards;
+  // The last object found, which may cover the following cards, so
+  // its bounds are found once per call.
+  size_t first = 0;
+  size_t last = 0;
+  // Typed objects are scanned whole.  The mutator does not run during
+  // the call so their other cards are clean.
+  size_t scanned = 0;
+  for (; *card != stop; ++*card)
+    {
+      if (cards_[*card] == 0)
+        {
+          continue;
+        }
+      cards_[*card] = 0;
+
+      // Young objects are scanned when they are marked so only the
+      // old objects on the card, which are already scanned, are
+      // scanned here.
+      size_t slot = std::max (*card * SLOTS_PER_CARD, scanned);
+      size_t card_end = *card * SLOTS_PER_CARD + SLOTS_PER_CARD;
+      while (slot < card_end)
+        {
+          if ((get_bits (slot) & SCANNED) == 0)
+            {
+              ++slot;
+              continue;
+            }
+
+          if (slot >= last)
+            {
+              for (first = slot; (get_bits (first) & OBJECT) == 0; --first)
+                ;
+              last = object_end (first);
+            }
+          unsigned char bits = get_bits (first);
+          if ((bits & TYPED) != 0)
+            {
+              heap->scan_units (static_cast<char*> (begin_) + first * SLOT_SIZE, static_cast<char*> (begin_) + last * SLOT_SIZE, work_list);
+              scanned = last;
+            }
+          else if ((bits & NOSCAN) == 0)
+            {
+              heap->scan (static_cast<char*> (begin_) + slot * SLOT_SIZE, static_cast<char*> (begin_) + std::min (last, card_end) * SLOT_SIZE, work_list);
+            }
+          slot = last;
+        }
+    }
+  return *card == cards;
+}
+
+void* Block::begin () const
+{
+  return begin_;
+}
+
+size_t Block::size () const
+{
+  return static_cast<char*> (end_) - static_cast<char*> (begin_);
+}
+
+Block* Block::link () const
+{
+  return link_;
+}
+
+bool Block::is_object (void* ptr) const
+{
+  size_t slot = this->slot (ptr);
+  unsigned char bits = get_bits (slot);
+  return (bits & OBJECT) && (swept_ || slot < sweep_slot_ || (bits & MARK));
+}
+
+bool Block::is_allocated (void* ptr) const
+{
+  size_t slot = this->slot (ptr);
+  unsigned char bits = get_bits (slot);
+  return (bits & ALLOCATED) && (swept_ || slot < sweep_slot_ || (bits & MARK));
+}
+
+bool Block::scan_worklist (Block** work_list, Heap* heap, const struct timespec* deadline)
+{
+  bool progress = false;
+  while (*work_list != NULL &&
+         *work_list != reinterpret_cast<Block*> (1))
+    {
+      // Scan at least one block per call so the collection finishes.
+      if (deadline != NULL && progress && past (deadline))
+        {
+          return false;
+        }
+      progress = true;
+      Block* b = *work_list;
+      *work_list = b->next_;
+      b->next_ = NULL;
+      b->scan (heap, work_list, deadline != NULL ? SCAN_SLOTS : SIZE_MAX);
+    }
+  *work_list = NULL;
+  return true;
+}
+
+void Block::merge (Block** list, Block* block, Heap* heap)
+{
+  if (block == NULL)
+    {
+      return;
+    }
+
+  // Relabel the blocks and splice them onto the front of the list.
+  Block* tail = block;
+  for (;;)
+    {
+      __atomic_store_n (&tail->heap_, heap, __ATOMIC_RELEASE);
+      if (tail->link_ == NULL)
+        {
+          break;
+        }
+      tail = tail->link_;
+    }
+  tail->link_ = *list;
+  *list = block;
+}
+
+Block::Block (size_t bits_bytes, size_t card_bytes)
+  : heap_ (NULL)
+  , begin_ (NULL)
+  , end_ (NULL)
+  , cards_ (NULL)
+  , bits_ (static_cast<unsigned char*> (::operator new (bits_bytes + card_bytes)))
+{
+  cards_ = bits_ + bits_bytes;
+  clear (bits_bytes + card_bytes);
+}
+
+void Block::clear (size_t bytes)
+{
+  link_ = NULL;
+  next_ = NULL;
+  scan_begin_ = SIZE_MAX;
+  scan_end_ = 0;
+  marked_ = false;
+  swept_ = true;
+  sweep_slot_ = 0;
+  sweep_free_ = SIZE_MAX;
+  dirty_ = false;
+  evacuate_ = false;
+  memset (bits_, 0, bytes);
+}
+
+Heap::Heap (void* b, size_t size)
+  : block_ (NULL)
+  , unswept_ (NULL)
+  , span_block_ (NULL)
+  , span_begin_ (NULL)
+  , span_next_ (NULL)
+  , span_limit_ (NULL)
+  , span_zero_ (false)
+  , allocated_size_ (0)
+  , next_block_size_ (0)
+  , next_collection_size_ (default_policy.min_size)
+  , generational_ (default_generational)
+  , full_ (true)
+  , sticky_ (false)
+  , live_size_ (0)
+  , next_full_size_ (0)
+  , policy_ (default_policy)
+  , requested_ (false)
+  , phase_ (Idle)
+  , cursor_ (NULL)
+  , cursor_index_ (0)
+  , rescans_ (0)
+  , marking_ (false)
+  , minor_ (false)
+  , pinning_ (false)
+  , fragmented_ (false)
+  , work_list_ (NULL)
+  , exclusive_ (false)
+  , begin_ (static_cast<char*> (b))
+  , end_ (begin_ + size)
+  , child_ (NULL)
+  , next_ (NULL)
+  , prev_ (NULL)
+  , parent_ (NULL)
+  , reachable_ (false)
+{
+  pthread_mutex_init (&mutex_, NULL);
+}
+
+Heap::Heap (size_t size_of_root)
+  : block_ (NULL)
+  , unswept_ (NULL)
+  , span_block_ (NULL)
+  , span_begin_ (NULL)
+  , span_next_ (NULL)
+  , span_limit_ (NULL)
+  , span_zero_ (false)
+  , allocated_size_ (0)
+  , next_block_size_ (0)
+  , next_collection_size_ (default_policy.min_size)
+  , generational_ (default_generational)
+  , full_ (true)
+  , sticky_ (false)
+  , live_size_ (0)
+  , next_full_size_ (0)
+  , policy_ (default_policy)
+  , requested_ (false)
+  , phase_ (Idle)
+  , cursor_ (NULL)
+  , cursor_index_ (0)
+  , rescans_ (0)
+  , marking_ (false)
+  , minor_ (false)
+  , pinning_ (false)
+  , fragmented_ (false)
+  , work_list_ (NULL)
+  , exclusive_ (false)
+  , begin_ (NULL)
+  , end_ (NULL)
+  , child_ (NULL)
+  , next_ (NULL)
+  , prev_ (NULL)
+  , parent_ (NULL)
+  , reachable_ (false)
+{
+  pthread_mutex_init (&mutex_, NULL);
+  begin_ = static_cast<char*> (allocate (size_of_root));
+  end_ = begin_ + size_of_root;
+}
+
+void*
+Heap::root () const
+{
+  return begin_;
+}
+
+void
+Heap::generational (bool flag)
+{
+  pthread_mutex_lock (&mutex_);
+  generational_ = flag;
+  full_ = true;
+  pthread_mutex_unlock (&mutex_);
+}
+
+bool
+Heap::generational () const
+{
+  return generational_;
+}
+
+bool
+Heap::collecting () const
+{
+  return phase_ != Idle;
+}
+
+void
+Heap::exclusive (bool flag)
+{
+  exclusive_ = flag;
+}
+
+bool
+Heap::exclusive () const
+{
+  return exclusive_;
+}
+
+void
+Heap::lock ()
+{
+  if (!exclusive_)
+    {
+      pthread_mutex_lock (&mutex_);
+    }
+}
+
+void
+Heap::unlock ()
+{
+  if (!exclusive_)
+    {
+      pthread_mutex_unlock (&mutex_);
+    }
+}
+
+void
+Heap::generational_default (bool flag)
+{
+  default_generational = flag;
+}
+
+void
+Heap::policy (const GcPolicy& policy)
+{
+  lock ();
+  policy_ = policy;
+  next_collection_size_ = std::max (next_collection_size_, policy_.min_size);
+  unlock ();
+}
+
+const GcPolicy&
+Heap::policy () const
+{
+  return policy_;
+}
+
+void
+Heap::policy_default (const GcPolicy& policy)
+{
+  default_policy = policy;
+}
+
+bool
+Heap::wants_collection () const
+{
+  return __atomic_load_n (&requested_, __ATOMIC_RELAXED);
+}
+
+void
+Heap::request ()
+{
+  for (Heap* h = this; h != NULL; h = h->parent_)
+    {
+      __atomic_store_n (&h->requested_, true, __ATOMIC_RELAXED);
+    }
+}
+
+size_t
+Heap::threshold (size_t size) const
+{
+  return std::max (static_cast<size_t> (size * policy_.growth), policy_.min_size);
+}
+
+void
+Heap::write_barrier (void* address, size_t size)
+{
+  PageMapEntry* entry = page_map_entry (address, false);
+  if (entry == NULL)
+    {
+      return;
+    }
+  Block* block = __atomic_load_n (&entry->block, __ATOMIC_ACQUIRE);
+  if (block != NULL)
+    {
+      block->dirty (address, size);
+    }
+}
+
+void*
+Heap::allocate (size_t size, const PointerMap* pointer_map)
+{
+  return allocate_object (size, pointer_map, true);
+}
+
+void*
+Heap::allocate_uninitialized (size_t size, const PointerMap* pointer_map)
+{
+  return allocate_object (size, pointer_map, false);
+}
+
+void*
+Heap::allocate_object (size_t size, const PointerMap* pointer_map, bool zero)
+{
+  if (size == 0)
+    {
+      return NULL;
+    }
+
+  const bool typed = pointer_map != NULL && pointer_map->has_pointers ();
+  const size_t requested_size = size;
+  if (typed)
+    {
+      // Room for the pointer map.
+      size += sizeof (void*);
+    }
+
+  lock ();
+
+  // Must be a multiple of the slot size.
+  size = util::align_up (size, SLOT_SIZE);
+
+  void* c;
+  Block* block;
+  bool known_zero;
+  if (size <= static_cast<size_t> (span_limit_ - span_next_))
+    {
+      // Fast path: bump the span.
+      c = span_next_;
+      span_next_ += size;
+      block = span_block_;
+      known_zero = span_zero_;
+    }
+  else
+    {
+      c = allocate_i (size, &block, &known_zero);
+    }
+  block->begin_object (c, pointer_map);
+  if (marking_)
+    {
+      // The object is scanned when the collection finishes.
+      block->allocate_marked (c, size);
+      if (c == span_begin_)
+        {
+          // Recorded so flushing the span does not visit it again.
+          span_begin_ += size;
+        }
+    }
+
+  // Clear the memory unless it is known to be zero.  Without
+  // clearing, only the padding after the requested bytes is cleared
+  // so the collector never follows stale words.
+  if (!known_zero)
+    {
+      if (zero)
+        {
+          memset (c, 0, size);
+        }
+      else
+        {
+          memset (static_cast<char*> (c) + requested_size, 0, size - requested_size);
+        }
+    }
+  if (typed)
+    {
+      reinterpret_cast<const PointerMap**> (static_cast<char*> (c) + size)[-1] = pointer_map;
+    }
+
+  allocated_size_ += size;
+  stats_.allocated_bytes += size;
+  if (allocated_size_ > next_collection_size_ && !requested_)
+    {
+      request ();
+    }
+
+  unlock ();
+
+  return c;
+}
+
+void*
+Heap::allocate_i (size_t size, Block** block, bool* zero)
+{
+  const bool small = size <= FreeLists::SMALL_CLASSES * SLOT_SIZE;
+
+  for (;;)
+    {
+      if (small)
+        {
+          // Bump through a large chunk.
+          size_t span_size;
+          void* span = free_lists_.remove_large (&span_size);
+          if (span != NULL)
+            {
+              set_span (Block::find (this, span), span, span_size, false);
+              break;
+            }
+        }
+
+      void* c = free_lists_.remove (size);
+      if (c != NULL)
+        {
+          *block = Block::find (this, c);
+          (*block)->allocate (c, size);
+          *zero = false;
+          return c;
+        }
+
+      // Sweep a block to replenish the free lists.
+      if (!sweep_block ())
+        {
+          // We need to allocate a block.
+          if (size > next_block_size_)
+            {
+              next_block_size_ = size;
+            }
+          // Allocate the block.
+          Block* b = Block::make (this, next_block_size_);
+          // Insert the block into the heap.
+          b->link_ = block_;
+          block_ = b;
+          next_block_size_ *= 2;
+
+          if (small)
+            {
+              // The storage of a new block is zero.
+              set_span (b, b->begin (), b->size (), true);
+              break;
+            }
+
+          c = b->begin ();
+          b->allocate (c, size);
+          if (b->size () != size)
+            {
+              free_lists_.insert (static_cast<char*> (c) + size, b->size () - size);
+            }
+          *block = b;
+          *zero = true;
+          return c;
+        }
+    }
+
+  void* c = span_next_;
+  span_next_ += size;
+  *block = span_block_;
+  *zero = span_zero_;
+  return c;
+}
+
+void
+Heap::set_span (Block* block, void* begin, size_t size, bool zero)
+{
+  retire_span ();
+  span_block_ = block;
+  span_zero_ = zero;
+  span_begin_ = static_cast<char*> (begin);
+  span_next_ = span_begin_;
+  span_limit_ = span_begin_ + size;
+}
+
+void
+Heap::flush_span ()
+{
+  if (span_block_ != NULL && span_next_ != span_begin_)
+    {
+      span_block_->allocate_span (span_begin_, span_next_ - span_begin_);
+      span_begin_ = span_next_;
+    }
+}
+
+void
+Heap::retire_span ()
+{
+  flush_span ();
+  if (span_next_ != span_limit_)
+    {
+      free_lists_.insert (span_next_, span_limit_ - span_next_);
+    }
+  span_block_ = NULL;
+  span_begin_ = NULL;
+  span_next_ = NULL;
+  span_limit_ = NULL;
+  span_zero_ = false;
+}
+
+bool
+Heap::sweep_block (size_t limit)
+{
+  Block* block = unswept_;
+  if (block == NULL)
+    {
+      return false;
+    }
+
+  sticky_ |= generational_;
+  if (block->sweep (&free_lists_, generational_, limit))
+    {
+      if (block->swept_)
+        {
+          unswept_ = block->link_;
+          block->link_ = block_;
+          block_ = block;
+        }
+    }
+  else
+    {
+      unswept_ = block->link_;
+      Block::release (block);
+    }
+  return true;
+}
+
+void
+Heap::reset_marks ()
+{
+  for (Block* b = block_; b != NULL; b = b->link_)
+    {
+      b->reset_marks ();
+    }
+  sticky_ = false;
+}
+
+Heap::~Heap ()
+{
+  // Free all the blocks.
+  while (block_ != NULL)
+    {
+      Block* b = block_;
+      block_ = b->link_;
+      Block::release (b);
+    }
+  while (unswept_ != NULL)
+    {
+      Block* b = unswept_;
+      unswept_ = b->link_;
+      Block::release (b);
+    }
+
+  // Free the child heaps.
+  while (child_ != NULL)
+    {
+      Heap* c = child_;
+      child_ = c->next_;
+      delete c;
+    }
+}
+
+void
+Heap::mark_slot_for_address (void* p, Block** work_list, bool pin)
+{
+  Block* block = Block::find (this, p);
+  if (block != NULL)
+    {
+      allocated_size_ += block->mark (p, work_list, pin) * SLOT_SIZE;
+    }
+  else
+    {
+      Heap* ptr;
+      for (ptr = this->child_; ptr != NULL; ptr = ptr->next_)
+        {
+          if (ptr == (Heap*)p)
+            {
+              ptr->reachable_ = true;
+              break;
+            }
+        }
+    }
+}
+
+void
+Heap::scan (void* begin, void* end, Block** work_list)
+{
+  char** b;
+  char** e;
+
+  b = (char**)util::align_up ((size_t)begin, sizeof (void*));
+  e = (char**)end;
+
+  for (; b < e; ++b)
+    {
+      char* p = *b;
+      mark_slot_for_address (p, work_list, pinning_);
+    }
+}
+
+// Scan an object with a pointer map in its last word.
+void
+Heap::scan_units (void* begin, void* end, Block** work_list)
+{
+  char* b = static_cast<char*> (begin);
+  char* e = static_cast<char*> (end) - sizeof (void*);
+  const PointerMap* pointer_map = *reinterpret_cast<const PointerMap**> (e);
+
+  for (; b + pointer_map->size <= e; b += pointer_map->size)
+    {
+      for (std::vector<size_t>::const_iterator pos = pointer_map->offsets.begin (),
+           limit = pointer_map->offsets.end ();
+           pos != limit;
+           ++pos)
+        {
+          mark_slot_for_address (*reinterpret_cast<void**> (b + *pos), work_list);
+        }
+    }
+}
+
+bool
+Heap::collect_garbage (bool force)
+{
+  struct timespec begin;
+  struct timespec deadline;
+  const struct timespec* d = NULL;
+  lock ();
+  clock_gettime (CLOCK_MONOTONIC, &begin);
+  if (policy_.pause_budget != 0 && !force)
+    {
+      deadline = begin;
+      deadline.tv_sec += policy_.pause_budget / 1000000000;
+      deadline.tv_nsec += policy_.pause_budget % 1000000000;
+      if (deadline.tv_nsec >= 1000000000)
+        {
+          ++deadline.tv_sec;
+          deadline.tv_nsec -= 1000000000;
+        }
+      d = &deadline;
+    }
+  bool retval = collect (force, d);
+  end_pause (begin);
+  unlock ();
+  return retval;
+}
+
+void
+Heap::end_pause (const struct timespec& begin)
+{
+  struct timespec end;
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  const unsigned long pause = (end.tv_sec - begin.tv_sec) * 1000000000UL + end.tv_nsec - begin.tv_nsec;
+  stats_.pause_ns += pause;
+  stats_.max_pause_ns = std::max (stats_.max_pause_ns, pause);
+}
+
+bool
+Heap::collect (bool force, const struct timespec* deadline)
+{
+  __atomic_store_n (&requested_, false, __ATOMIC_RELAXED);
+
+  if (collecting () && force)
+    {
+      // Finish the current collection before forcing another.
+      advance (false, NULL);
+      finish_collection (NULL);
+    }
+
+  // Strictly greater.  This avoids continuous collection if both are zero.
+  if (!collecting () && !force && allocated_size_ <= next_collection_size_)
+    {
+      // Just process children.
+      return collect_children (deadline);
+    }
+
+  if (!collecting ())
+    {
+      phase_ = Sweeping;
+    }
+
+  if (!advance (force, deadline))
+    {
+      // Resume at the next call.
+      request ();
+      return true;
+    }
+
+  finish_collection (deadline);
+  return true;
+}
+
+bool
+Heap::advance (bool force, const struct timespec* deadline)
+{
+  // The mutator has not run since marking started in this call so
+  // there is nothing to rescan.
+  bool started = false;
+  size_t slots = deadline != NULL ? SCAN_SLOTS : SIZE_MAX;
+  size_t cards = deadline != NULL ? SCAN_CARDS : SIZE_MAX;
+  // Record the objects bumped since the last call so marking does not
+  // record them all when it begins.
+  flush_span ();
+  for (;;)
+    {
+      // Do one unit of work per iteration so every call progresses.
+      switch (phase_)
+        {
+        case Idle:
+          return true;
+
+        case Sweeping:
+          if (!sweep_block (slots))
+            {
+              // A minor collection keeps the old objects and their marks.
+              minor_ = generational_ && !force && !full_ && sticky_;
+              if (minor_)
+                {
+                  begin_marking ();
+                  started = true;
+                }
+              else
+                {
+                  phase_ = Resetting;
+                  cursor_ = block_;
+                  cursor_index_ = 0;
+                }
+            }
+          break;
+
+        case Resetting:
+          if (cursor_ == NULL)
+            {
+              sticky_ = false;
+              begin_marking ();
+              started = true;
+            }
+          else if (!sticky_ || cursor_->reset_marks (&cursor_index_, slots))
+            {
+              cursor_->clean_cards ();
+              cursor_ = cursor_->link_;
+              cursor_index_ = 0;
+            }
+          break;
+
+        case Marking:
+          if (!Block::scan_worklist (&work_list_, this, deadline))
+            {
+              return false;
+            }
+          if (cursor_ != NULL)
+            {
+              // Old objects may point to young objects.
+              scan_cards (cards);
+            }
+          else if (started)
+            {
+              return true;
+            }
+          else
+            {
+              phase_ = Rescanning;
+              rescans_ = 0;
+            }
+          break;
+
+        case Rescanning:
+          if (!Block::scan_worklist (&work_list_, this, deadline))
+            {
+              return false;
+            }
+          if (cursor_ != NULL)
+            {
+              scan_cards (cards);
+              break;
+            }
+          // Pointers may have been stored in the roots and in objects
+          // that were already scanned.
+          scan (begin_, end_, &work_list_);
+          if (work_list_ == NULL && !dirty ())
+            {
+              return true;
+            }
+          cursor_ = block_;
+          cursor_index_ = 0;
+          if (++rescans_ == RESCAN_PASSES)
+            {
+              // Finish in this call.
+              deadline = NULL;
+              slots = SIZE_MAX;
+              cards = SIZE_MAX;
+            }
+          break;
+        }
+
+      if (deadline != NULL && past (deadline))
+        {
+          return false;
+        }
+    }
+}
+
+void
+Heap::begin_marking ()
+{
+  // Objects bumped from the span are recorded as allocated so they
+  // can be marked.
+  retire_span ();
+  work_list_ = NULL;
+  allocated_size_ = minor_ ? live_size_ : 0;
+  Block* b = Block::find (this, begin_);
+  if (b != NULL)
+    {
+      allocated_size_ += b->mark (begin_, &work_list_, pinning_) * SLOT_SIZE;
+    }
+  scan (begin_, end_, &work_list_);
+  marking_ = true;
+  phase_ = Marking;
+  cursor_ = minor_ ? block_ : NULL;
+  cursor_index_ = 0;
+}
+
+void
+Heap::scan_cards (size_t limit)
+{
+  if (cursor_->scan_cards (this, &work_list_, &cursor_index_, limit))
+    {
+      cursor_ = cursor_->link_;
+      cursor_index_ = 0;
+    }
+}
+
+bool
+Heap::dirty () const
+{
+  for (Block* b = block_; b != NULL; b = b->link_)
+    {
+      if (b->dirty_)
+        {
+          return true;
+        }
+    }
+  return false;
 }
-#endif
 
-// Return the number of allocated slots.
-size_t Block::sweep (Block** b, Chunk** head)
+void
+Heap::finish_collection (const struct timespec* deadline)
 {
-  Block* block = *b;
-
-  if (block == NULL)
+  marking_ = false;
+  phase_ = Idle;
+  cursor_ = NULL;
+  __atomic_store_n (&fragmented_, true, __ATOMIC_RELAXED);
+  ++stats_.collections;
+  stats_.live_bytes = allocated_size_;
+
+  // Every block is swept lazily and the free lists will be rebuilt.
+  // The span may have been taken while marking.
+  retire_span ();
+  free_lists_.clear ();
+  for (Block* b = block_; b != NULL; b = b->link_)
     {
-      return 0;
+      b->swept_ = false;
     }
+  unswept_ = block_;
+  block_ = NULL;
 
-  size_t retval = 0;
-
-  retval += sweep (&block->left_, head);
-  retval += sweep (&block->right_, head);
-
-  if (block->marked_)
+  if (generational_)
     {
-      size_t slot = 0;
-      size_t max_slot = ((char*)block->end_ - (char*)block->begin_) / SLOT_SIZE;
-      while (slot != max_slot)
+      if (!minor_)
         {
-          unsigned char bits = block->get_bits (slot);
-          if ((bits & MARK) != 0)
-            {
-              // Marked.
-              block->reset_bits (slot, SCANNED | MARK);
-              ++slot;
-              ++retval;
-            }
-          else
-            {
-              // Not marked.
-              size_t slot_begin = slot;
-              for (; slot != max_slot && (block->get_bits (slot) & MARK) == 0; ++slot)
-                {
-                  block->clear_bits (slot);
-                }
-              Chunk* c = reinterpret_cast<Chunk*>((char*)block->begin_ + slot_begin * SLOT_SIZE);
-              c->size = (slot - slot_begin) * SLOT_SIZE;
-              c->next = *head;
-              *head = c;
-            }
+          next_full_size_ = threshold (allocated_size_);
         }
-      block->marked_ = false;
+      full_ = allocated_size_ > next_full_size_;
+      live_size_ = allocated_size_;
+      next_collection_size_ = std::max (allocated_size_ + NURSERY_SIZE, policy_.min_size);
     }
   else
     {
-      Block* left = block->left_;
-      Block* right = block->right_;
+      next_collection_size_ = threshold (allocated_size_);
+    }
+  next_block_size_ = allocated_size_;
 
-      if (left == NULL && right == NULL)
-        {
-          *b = NULL;
-        }
-      else if (left == NULL && right != NULL)
-        {
-          *b = right;
-        }
-      else if (left != NULL && right == NULL)
+  Heap** child = &this->child_;
+  while (*child != NULL)
+    {
+      if (minor_ || (*child)->reachable_)
         {
-          *b = left;
+          // Keep reachable children.  A child is only known to be
+          // unreachable after a full collection since old objects are
+          // not scanned.
+          (*child)->reachable_ = false;
+          child = &(*child)->next_;
         }
       else
         {
-          Block* r = Block::remove_right_most (&block->left_);
-          r->left_ = block->left_;
-          r->right_ = block->right_;
-          *b = r;
+          // Free unreachable children.
+          Heap* h = *child;
+          *child = h->next_;
+          if (h->next_ != NULL)
+            {
+              h->next_->prev_ = child;
+            }
+          delete h;
         }
-
-      // Free the data.
-      block->left_ = NULL;
-      block->right_ = NULL;
-      delete block;
     }
 
-  return retval;
-}
-
-void* Block::begin () const
-{
-  return begin_;
-}
-
-bool Block::is_object (void* ptr) const
-{
-  size_t slot = this->slot (ptr);
-  unsigned char bits = get_bits (slot);
-  return bits & OBJECT;
-}
-
-bool Block::is_allocated (void* ptr) const
-{
-  size_t slot = this->slot (ptr);
-  unsigned char bits = get_bits (slot);
-  return bits & ALLOCATED;
+  // Recur on the remaining children.
+  collect_children (deadline);
 }
 
-void Block::scan_worklist (Block* work_list, Heap* heap)
+bool
+Heap::collect_children (const struct timespec* deadline)
 {
-  while (work_list != NULL &&
-         work_list != reinterpret_cast<Block*> (1))
+  if (collector_count == 0 || child_ == NULL || child_->next_ == NULL)
     {
-      Block* b = work_list;
-      work_list = b->next_;
-      b->next_ = NULL;
-      b->scan (heap, &work_list);
+      bool retval = false;
+      for (Heap* child = this->child_; child != NULL; child = child->next_)
+        {
+          pthread_mutex_lock (&child->mutex_);
+          retval |= child->collect (false, deadline);
+          pthread_mutex_unlock (&child->mutex_);
+        }
+      return retval;
     }
-}
 
-void Block::merge (Block** root, Block* block)
-{
-  if (block != NULL)
+  ChildBatch batch;
+  batch.next = child_;
+  batch.pending = 0;
+  batch.deadline = deadline;
+  batch.collected = false;
+  pthread_mutex_lock (&collector_mutex);
+  batch.link = collector_queue;
+  collector_queue = &batch;
+  pthread_cond_broadcast (&collector_work);
+  while (batch.next != NULL || batch.pending != 0)
     {
-      merge (root, block->left_);
-      block->left_ = NULL;
-      merge (root, block->right_);
-      block->right_ = NULL;
-      Block::insert (root, block);
+      if (collector_queue != NULL)
+        {
+          // Help instead of waiting.  The child may belong to another
+          // batch.
+          ChildBatch* b;
+          Heap* child = claim_child (&b);
+          collect_child (b, child);
+        }
+      else
+        {
+          pthread_cond_wait (&collector_done, &collector_mutex);
+        }
     }
+  pthread_mutex_unlock (&collector_mutex);
+  return batch.collected;
 }
 
-Block::Block (size_t bits_bytes)
-  : left_ (NULL)
-  , right_ (NULL)
-  , next_ (NULL)
-  , begin_ (NULL)
-  , end_ (NULL)
-  , marked_ (false)
-{
-  memset (bits_, 0, bits_bytes);
-}
-
-Heap::Heap (void* b, size_t size)
-  : block_ (NULL)
-  , free_list_head_ (NULL)
-  , allocated_size_ (0)
-  , next_block_size_ (0)
-  , next_collection_size_ (0)
-  , begin_ (static_cast<char*> (b))
-  , end_ (begin_ + size)
-  , child_ (NULL)
-  , next_ (NULL)
-  , parent_ (NULL)
-  , reachable_ (false)
-{
-  pthread_mutex_init (&mutex_, NULL);
-}
-
-Heap::Heap (size_t size_of_root)
-  : block_ (NULL)
-  , free_list_head_ (NULL)
-  , allocated_size_ (0)
-  , next_block_size_ (0)
-  , next_collection_size_ (0)
-  , begin_ (NULL)
-  , end_ (NULL)
-  , child_ (NULL)
-  , next_ (NULL)
-  , parent_ (NULL)
-  , reachable_ (false)
+// Claim the next child of the first batch.  The collector mutex is held.
+Heap*
+Heap::claim_child (ChildBatch** batch)
 {
-  pthread_mutex_init (&mutex_, NULL);
-  begin_ = static_cast<char*> (allocate (size_of_root));
-  end_ = begin_ + size_of_root;
+  ChildBatch* b = collector_queue;
+  Heap* child = b->next;
+  b->next = child->next_;
+  if (b->next == NULL)
+    {
+      collector_queue = b->link;
+    }
+  ++b->pending;
+  *batch = b;
+  return child;
 }
 
-void*
-Heap::root () const
+// Collect a claimed child.  The collector mutex is held on entry and
+// exit and released while collecting.
+void
+Heap::collect_child (ChildBatch* batch, Heap* child)
 {
-  return begin_;
+  pthread_mutex_unlock (&collector_mutex);
+  pthread_mutex_lock (&child->mutex_);
+  const bool collected = child->collect (false, batch->deadline);
+  pthread_mutex_unlock (&child->mutex_);
+  pthread_mutex_lock (&collector_mutex);
+  batch->collected |= collected;
+  if (--batch->pending == 0 && batch->next == NULL)
+    {
+      pthread_cond_broadcast (&collector_done);
+    }
 }
 
 void*
-Heap::allocate (size_t size)
+Heap::collector_main (void*)
 {
-  if (size == 0)
-    {
-      return NULL;
-    }
-
-  pthread_mutex_lock (&mutex_);
-
-  // Must be a multiple of the slot size.
-  size = util::align_up (size, SLOT_SIZE);
-
-  // Find a chunk.
-  Chunk** chunk;
-  for (chunk = &free_list_head_;
-       *chunk != NULL && (*chunk)->size < size;
-       chunk = &(*chunk)->next)
-    ;;
-
-  Block* block = NULL;
-
-  if (*chunk == NULL)
+  pthread_mutex_lock (&collector_mutex);
+  for (;;)
     {
-      // We need to allocate a block.
-      if (size > next_block_size_)
+      while (collector_queue == NULL)
         {
-          next_block_size_ = size;
+          pthread_cond_wait (&collector_work, &collector_mutex);
         }
-      // Allocate the block.
-      block = Block::make (next_block_size_);
-      // Insert the block into the heap.
-      Block::insert (&(this->block_), block);
-      // Insert the chunk at the end of the free list.
-      *chunk = reinterpret_cast<Chunk*> (block->begin ());
-      (*chunk)->size = next_block_size_;
-      (*chunk)->next = NULL;
-
-      next_block_size_ *= 2;
+      ChildBatch* b;
+      Heap* child = claim_child (&b);
+      collect_child (b, child);
     }
+  return NULL;
+}
 
-  // Remove the chunk from the free list.
-  Chunk* c = *chunk;
-  *chunk = c->next;
-
-  // Split the chunk and reinsert.
-  if (c->size - size > 0)
+void
+Heap::collector_threads (size_t count)
+{
+  pthread_attr_t attr;
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  for (size_t idx = 0; idx != count; ++idx)
     {
-      Chunk* d = reinterpret_cast<Chunk*> ((char*)c + size);
-      d->size = c->size - size;
-      d->next = free_list_head_;
-      free_list_head_ = d;
+      pthread_t thread;
+      if (pthread_create (&thread, &attr, collector_main, NULL) != 0)
+        {
+          break;
+        }
+      pthread_mutex_lock (&collector_mutex);
+      ++collector_count;
+      pthread_mutex_unlock (&collector_mutex);
     }
+  pthread_attr_destroy (&attr);
+}
 
-  // Find the block containing this chunk.
-  if (block == NULL)
+bool
+Heap::compact ()
+{
+  struct timespec begin;
+  lock ();
+  clock_gettime (CLOCK_MONOTONIC, &begin);
+  __atomic_store_n (&requested_, false, __ATOMIC_RELAXED);
+  if (collecting ())
     {
-      block = Block::find (this->block_, c);
+      advance (false, NULL);
+      finish_collection (NULL);
     }
 
-  block->allocate (c, size);
-
-  // Clear the memory.
-  memset (c, 0, size);
-
-  allocated_size_ += size;
-
-  pthread_mutex_unlock (&mutex_);
-
-  return c;
+  pinning_ = true;
+  phase_ = Sweeping;
+  advance (true, NULL);
+  pinning_ = false;
+  const bool moved = evacuate ();
+  finish_collection (NULL);
+  __atomic_store_n (&fragmented_, false, __ATOMIC_RELAXED);
+  end_pause (begin);
+  unlock ();
+  return moved;
 }
 
-Heap::~Heap ()
+bool
+Heap::wants_compaction () const
 {
-  // Free all the blocks.
-  if (block_)
-    {
-      delete block_;
-    }
-
-  // Free the child heaps.
-  while (child_ != NULL)
-    {
-      Heap* c = child_;
-      child_ = c->next_;
-      delete c;
-    }
+  return policy_.compact && __atomic_load_n (&fragmented_, __ATOMIC_RELAXED);
 }
 
-void
-Heap::mark_slot_for_address (void* p, Block** work_list)
+bool
+Heap::evacuate ()
 {
-  Block* block = Block::find (this->block_, p);
-  if (block != NULL)
-    {
-      block->mark (p, work_list);
-    }
-  else
+  // Choose the blocks that are less than half full and count the
+  // bytes that can move out of them.
+  size_t bytes = 0;
+  for (Block* b = block_; b != NULL; b = b->link_)
     {
-      Heap* ptr;
-      for (ptr = this->child_; ptr != NULL; ptr = ptr->next_)
+      const size_t slots = b->size () / SLOT_SIZE;
+      size_t live = 0;
+      size_t movable = 0;
+      for (size_t slot = 0; slot != slots;)
         {
-          if (ptr == (Heap*)p)
+          const unsigned char bits = b->get_bits (slot);
+          if ((bits & (OBJECT | MARK)) != (OBJECT | MARK))
             {
-              ptr->reachable_ = true;
-              break;
+              ++slot;
+              continue;
             }
+          const size_t end = b->object_end (slot);
+          live += end - slot;
+          if ((bits & PINNED) == 0)
+            {
+              movable += end - slot;
+            }
+          slot = end;
+        }
+      b->evacuate_ = movable != 0 && 2 * live < slots;
+      if (b->evacuate_)
+        {
+          bytes += movable * SLOT_SIZE;
         }
     }
-}
-
-void
-Heap::scan (void* begin, void* end, Block** work_list)
-{
-  char** b;
-  char** e;
-
-  b = (char**)util::align_up ((size_t)begin, sizeof (void*));
-  e = (char**)end;
 
-  for (; b < e; ++b)
+  if (bytes == 0)
     {
-      char* p = *b;
-      mark_slot_for_address (p, work_list);
+      return false;
     }
-}
 
-bool
-Heap::collect_garbage (bool force)
-{
-  bool retval = false;
-  pthread_mutex_lock (&mutex_);
-  // Strictly greater.  This avoids continuous collection if both are zero.
-  if (force || allocated_size_ > next_collection_size_)
+  // Copy the objects into a new block.
+  Block* to = Block::make (this, bytes);
+  to->link_ = block_;
+  block_ = to;
+  to->marked_ = true;
+  char* next = static_cast<char*> (to->begin_);
+  for (Block* b = to->link_; b != NULL; b = b->link_)
     {
-      // Full collection.
-      Block* work_list = NULL;
-      Block* b = Block::find (block_, begin_);
-      if (b != NULL)
+      if (!b->evacuate_)
         {
-          b->mark (begin_, &work_list);
+          continue;
         }
-      scan (begin_, end_, &work_list);
-
-      Block::scan_worklist (work_list, this);
 
-      // Sweep the heap (reconstruct the free list).
-      free_list_head_ = NULL;
-      allocated_size_ = Block::sweep (&block_, &free_list_head_) * SLOT_SIZE;
-      next_collection_size_ = allocated_size_ * 2;
-      next_block_size_ = allocated_size_;
-
-      Heap** child = &this->child_;
-      while (*child != NULL)
+      const size_t slots = b->size () / SLOT_SIZE;
+      b->marked_ = false;
+      for (size_t slot = 0; slot != slots;)
         {
-          if ((*child)->reachable_)
+          const unsigned char bits = b->get_bits (slot);
+          if ((bits & (OBJECT | MARK)) != (OBJECT | MARK))
             {
-              // Recur on reachable children.
-              (*child)->collect_garbage ();
-              (*child)->reachable_ = false;
-              child = &(*child)->next_;
+              ++slot;
+              continue;
             }
-          else
+          const size_t end = b->object_end (slot);
+          if ((bits & PINNED) != 0)
+            {
+              b->marked_ = true;
+              slot = end;
+              continue;
+            }
+
+          char* from = static_cast<char*> (b->begin_) + slot * SLOT_SIZE;
+          const size_t t = to->slot (next);
+          memcpy (next, from, (end - slot) * SLOT_SIZE);
+          for (size_t s = slot; s != end; ++s)
             {
-              // Free unreachable children.
-              Heap* h = *child;
-              *child = h->next_;
-              delete h;
+              to->bits_[t + s - slot] = b->get_bits (s);
+              b->reset_bits (s, MARK | SCANNED);
             }
+          b->set_bits (slot, FORWARDED);
+          *reinterpret_cast<char**> (from) = next;
+          next += (end - slot) * SLOT_SIZE;
+          slot = end;
         }
-      retval = true;
     }
-  else
+
+  // Update the pointers named by the pointer maps of the marked
+  // objects and unpin them.
+  for (Block* b = block_; b != NULL; b = b->link_)
     {
-      // Just process children.
-      for (Heap* child = this->child_; child != NULL; child = child->next_)
+      const size_t slots = b->size () / SLOT_SIZE;
+      for (size_t slot = 0; slot != slots;)
         {
-          retval |= child->collect_garbage ();
+          const unsigned char bits = b->get_bits (slot);
+          b->reset_bits (slot, PINNED);
+          if ((bits & (OBJECT | MARK | TYPED)) != (OBJECT | MARK | TYPED))
+            {
+              ++slot;
+              continue;
+            }
+          const size_t end = b->object_end (slot);
+          char* p = static_cast<char*> (b->begin_) + slot * SLOT_SIZE;
+          char* e = static_cast<char*> (b->begin_) + end * SLOT_SIZE - sizeof (void*);
+          const PointerMap* pointer_map = *reinterpret_cast<const PointerMap**> (e);
+          for (; p + pointer_map->size <= e; p += pointer_map->size)
+            {
+              for (std::vector<size_t>::const_iterator pos = pointer_map->offsets.begin (),
+                   limit = pointer_map->offsets.end ();
+                   pos != limit;
+                   ++pos)
+                {
+                  void** q = reinterpret_cast<void**> (p + *pos);
+                  *q = forward (*q);
+                }
+            }
+          slot = end;
         }
     }
-  pthread_mutex_unlock (&mutex_);
-  return retval;
+
+  for (Block* b = block_; b != NULL; b = b->link_)
+    {
+      b->evacuate_ = false;
+    }
+  return true;
+}
+
+void*
+Heap::forward (void* p) const
+{
+  Block* b = Block::find (this, p);
+  if (b == NULL || !b->evacuate_)
+    {
+      return p;
+    }
+  const size_t slot = b->slot (p);
+  if ((b->get_bits (slot) & ALLOCATED) == 0)
+    {
+      return p;
+    }
+  size_t first;
+  for (first = slot; (b->get_bits (first) & OBJECT) == 0; --first)
+    ;
+  if ((b->get_bits (first) & FORWARDED) == 0)
+    {
+      return p;
+    }
+  char* old = static_cast<char*> (b->begin_) + first * SLOT_SIZE;
+  return *reinterpret_cast<char**> (old) + (static_cast<char*> (p) - old);
 }
 
+void
+Heap::abandon_collection ()
+{
+  while (sweep_block ())
+    ;;
+  reset_marks ();
+  work_list_ = NULL;
+  marking_ = false;
+  phase_ = Idle;
+  cursor_ = NULL;
+}
 
 void
 Heap::merge (Heap* x)
 {
-  pthread_mutex_lock (&mutex_);
+  lock ();
+  x->retire_span ();
+  if (collecting () || x->collecting ())
+    {
+      // The marks of x do not belong to the collection of this heap.
+      // The objects of x are found through the roots and dirty cards
+      // when the collection finishes.  Its marks and cards are reset
+      // so a reset in progress need not visit its blocks.
+      x->abandon_collection ();
+    }
+
   // Merge the blocks.
-  Block::merge (&block_, x->block_);
+  Block::merge (&block_, x->block_, this);
   x->block_ = NULL;
+  Block::merge (&unswept_, x->unswept_, this);
+  x->unswept_ = NULL;
 
-  // Merge the free list.
-  Chunk** ch;
-  for (ch = &free_list_head_; *ch != NULL; ch = &(*ch)->next)
-    ;;
-  *ch = x->free_list_head_;
+  // Merge the free lists.
+  free_lists_.append (x->free_lists_);
 
   allocated_size_ += x->allocated_size_;
+  stats_.allocated_bytes += x->stats_.allocated_bytes;
   // Not quite sure how to combine next_collection_size.
   // Doing nothing should work but may not be optimal.
+  if (allocated_size_ > next_collection_size_)
+    {
+      request ();
+    }
 
-  // Merge the children.
-  Heap** h;
-  for (h = &child_; *h != NULL; h = &(*h)->next_)
-    ;;
-  *h = x->child_;
-  x->child_ = NULL;
+  // The old objects of x may point to young objects without a dirty
+  // card in this heap.
+  sticky_ |= x->sticky_;
+  full_ = true;
+
+  // Merge the children onto the front of the list.
+  if (x->child_ != NULL)
+    {
+      Heap* tail = x->child_;
+      for (;;)
+        {
+          tail->parent_ = this;
+          if (tail->next_ == NULL)
+            {
+              break;
+            }
+          tail = tail->next_;
+        }
+      tail->next_ = child_;
+      if (child_ != NULL)
+        {
+          child_->prev_ = &tail->next_;
+        }
+      child_ = x->child_;
+      child_->prev_ = &child_;
+      x->child_ = NULL;
+    }
 
   // Free the heap.
   delete x;
 
-  pthread_mutex_unlock (&mutex_);
+  unlock ();
 }
 
 void
 Heap::insert_child (Heap* child)
 {
-  pthread_mutex_lock (&this->mutex_);
+  lock ();
   child->parent_ = this;
+  child->policy_ = policy_;
   child->next_ = this->child_;
+  child->prev_ = &this->child_;
+  if (this->child_ != NULL)
+    {
+      this->child_->prev_ = &child->next_;
+    }
   this->child_ = child;
   // Force garbage collection.
   this->next_collection_size_ = 0;
-  pthread_mutex_unlock (&this->mutex_);
+  request ();
+  unlock ();
 }
 
 void
@@ -675,23 +2290,25 @@ Heap::remove_from_parent ()
 
   if (parent != NULL)
     {
-      pthread_mutex_lock (&parent->mutex_);
-      Heap** ptr = &(parent->child_);
-      while (*ptr != this)
-        {
-          ptr = &(*ptr)->next_;
-        }
+      parent->lock ();
 
       // Remove from parent's list.
-      *ptr = this->next_;
+      *this->prev_ = this->next_;
+      if (this->next_ != NULL)
+        {
+          this->next_->prev_ = this->prev_;
+        }
+      this->next_ = NULL;
+      this->prev_ = NULL;
 
       // Make the child forget the parent.
       this->parent_ = NULL;
 
       // Force garbage collection.
       parent->next_collection_size_ = 0;
+      parent->request ();
 
-      pthread_mutex_unlock (&parent->mutex_);
+      parent->unlock ();
     }
 }
 
@@ -699,7 +2316,7 @@ bool
 Heap::contains (void* ptr)
 {
   pthread_mutex_lock (&mutex_);
-  bool retval = Block::find (block_, ptr) != NULL;
+  bool retval = Block::find (this, ptr) != NULL;
   pthread_mutex_unlock (&mutex_);
   return retval;
 }
@@ -708,7 +2325,7 @@ bool
 Heap::is_object (void* ptr)
 {
   pthread_mutex_lock (&mutex_);
-  Block* block = Block::find (this->block_, ptr);
+  Block* block = Block::find (this, ptr);
   if (block == NULL)
     {
       pthread_mutex_unlock (&mutex_);
@@ -724,18 +2341,43 @@ bool
 Heap::is_allocated (void* ptr)
 {
   pthread_mutex_lock (&mutex_);
-  Block* block = Block::find (this->block_, ptr);
+  Block* block = Block::find (this, ptr);
   if (block == NULL)
     {
       pthread_mutex_unlock (&mutex_);
       return false;
     }
 
+  flush_span ();
   bool r = block->is_allocated (ptr);
   pthread_mutex_unlock (&mutex_);
   return r;
 }
 
+void
+Heap::stats (HeapStats* stats) const
+{
+  HeapStats s = stats_;
+  s.heaps = 1;
+  s.used_bytes = allocated_size_;
+  for (Block* b = block_; b != NULL; b = b->link_)
+    {
+      ++s.blocks;
+      s.block_bytes += b->size ();
+    }
+  for (Block* b = unswept_; b != NULL; b = b->link_)
+    {
+      ++s.blocks;
+      s.block_bytes += b->size ();
+    }
+  stats->add (s);
+
+  for (Heap* child = child_; child != NULL; child = child->next_)
+    {
+      child->stats (stats);
+    }
+}
+
 bool
 Heap::is_child (Heap* child)
 {
@@ -758,7 +2400,7 @@ Heap::dump_i () const
 {
   printf ("%zd heap=%p begin=%p end=%p next_sz=%zd reachable=%d parent=%p next=%p\n", pthread_self(), this, this->begin_, this->end_, this->next_block_size_, this->reachable_, this->parent_, this->next_);
 
-  if (Block::find (this->block_, this->begin_) == NULL)
+  if (Block::find (this, this->begin_) == NULL)
     {
       char** begin = (char**)this->begin_;
       char** end = (char**)this->end_;
@@ -768,17 +2410,17 @@ Heap::dump_i () const
         }
     }
 
-  if (this->block_)
+  for (Block* b = this->block_; b != NULL; b = b->link_)
     {
-      this->block_->dump ();
+      b->dump ();
     }
-
-  Chunk* ch;
-  for (ch = this->free_list_head_; ch != NULL; ch = ch->next)
+  for (Block* b = this->unswept_; b != NULL; b = b->link_)
     {
-      printf ("%zd chunk=%p size=%zd next=%p\n", pthread_self(), ch, ch->size, ch->next);
+      b->dump ();
     }
 
+  free_lists_.dump ();
+
   Heap* c;
   for (c = this->child_; c != NULL; c = c->next_)
     {
@@ -792,6 +2434,7 @@ void
 Heap::dump ()
 {
   pthread_mutex_lock (&mutex_);
+  flush_span ();
   dump_i ();
   pthread_mutex_unlock (&mutex_);
 }
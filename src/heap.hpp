@@ -2,7 +2,10 @@
 #define RC_SRC_HEAP_HPP
 
 #include "types.hpp"
-#include <config.h>
+
+#include <time.h>
+
+#include <vector>
 
 namespace runtime
 {
@@ -14,20 +17,159 @@ struct Chunk
   size_t size;
 };
 
+// The locations of the pointers in an object.  An object is a
+// sequence of units of the given size and every unit has pointers at
+// the same offsets.
+struct PointerMap
+{
+  PointerMap (size_t a_size) : size (a_size) { }
+  bool has_pointers () const
+  {
+    return !offsets.empty ();
+  }
+
+  // Size of a unit in bytes.
+  size_t const size;
+  // Offsets in bytes of the pointers in a unit.
+  std::vector<size_t> offsets;
+};
+
+// When a heap is collected.
+struct GcPolicy
+{
+  GcPolicy ()
+    : growth (2)
+    , min_size (0)
+    , pause_budget (0)
+    , compact (false)
+  { }
+
+  // The heap is collected when it grows past growth times its live
+  // bytes after the last collection.
+  double growth;
+  // The heap is not collected until it has at least this many bytes.
+  size_t min_size;
+  // An unforced collection stops after this many nanoseconds and
+  // resumes at the next call.  A step may run over by one unit of
+  // work: a slice of a block, the root, the cards of an object or a
+  // child.  Zero disables incremental collection.  Stores of pointers
+  // into the heap must call write_barrier.
+  unsigned long pause_budget;
+  // The heap may be compacted when the scheduler finds the program
+  // quiescent.
+  bool compact;
+};
+
+// Counters of a heap for profiling.
+struct HeapStats
+{
+  HeapStats ();
+  // Add the counters of other.
+  void add (const HeapStats& other);
+  // Return the fraction of the block bytes not used by objects.
+  double fragmentation () const;
+
+  // Number of heaps counted.
+  size_t heaps;
+  // Bytes allocated since the heap was created.
+  size_t allocated_bytes;
+  // Bytes marked by the last collection.
+  size_t live_bytes;
+  // Bytes marked by the last collection or allocated since.
+  size_t used_bytes;
+  // Number of blocks and their bytes.
+  size_t blocks;
+  size_t block_bytes;
+  // Number of finished collections.
+  size_t collections;
+  // Time spent in collect_garbage and compact, and the longest call
+  // (nanoseconds).
+  unsigned long pause_ns;
+  unsigned long max_pause_ns;
+  // Number of objects scanned for pointers.
+  size_t scanned_objects;
+};
+
+// Free chunks segregated by size.  A small chunk is kept in the list
+// for its exact number of slots so a small allocation is a pop from a
+// list.  Large chunks are kept in a single list searched first-fit.
+struct FreeLists
+{
+  // Number of small size classes.  Class k holds chunks of k + 1 slots.
+  static const size_t SMALL_CLASSES = 16;
+
+  FreeLists ();
+  // Return a chunk of size bytes to the free lists.
+  void insert (void* address, size_t size);
+  // Remove and return size bytes or NULL if no chunk is large enough.
+  void* remove (size_t size);
+  // Remove and return a whole large chunk or NULL if there is none.
+  void* remove_large (size_t* size);
+  // Move the chunks of other into these free lists.
+  void append (FreeLists& other);
+  void clear ();
+#ifndef COVERAGE
+  void dump () const;
+#endif
+
+private:
+  Chunk* small_[SMALL_CLASSES];
+  Chunk* large_;
+};
+
+// The children of a heap that are collected in parallel.
+struct ChildBatch;
+
 struct Block
 {
   ~Block ();
 
-  static Block* make (size_t size);
-  static void insert (Block** ptr, Block* block);
-  static Block* find (Block* block, void* address);
-  static void scan_worklist (Block* work_list, Heap* heap);
-  static size_t sweep (Block** b, Chunk** head);
-  static void merge (Block** root, Block* block);
+  // Make a block of at least size bytes with zeroed storage.  The
+  // block is taken from the pool if possible.
+  static Block* make (Heap* heap, size_t size);
+  // Return the block to the pool or free it.
+  static void release (Block* block);
+  // Headers are kept for reuse and never returned to the system.
+  static void* operator new (size_t size);
+  static void operator delete (void* p);
+  static Block* find (const Heap* heap, void* address);
+  // Scan the blocks on the work list until it is empty or the
+  // deadline passes.  Return true if the work list is empty.
+  static bool scan_worklist (Block** work_list, Heap* heap, const struct timespec* deadline);
+  static void merge (Block** list, Block* block, Heap* heap);
 
   void allocate (void* address, size_t size);
-  void mark (void* address, Block** work_list);
+  // Record the beginning of an object and how it is scanned.
+  void begin_object (void* address, const PointerMap* pointer_map);
+  // Record that the slots of a span are allocated.
+  void allocate_span (void* address, size_t size);
+  // Return the number of slots newly marked.  If pin is true, the
+  // object does not move when the heap is compacted.
+  size_t mark (void* address, Block** work_list, bool pin = false);
+  // Return unmarked slots to the free lists.  The marks are reset
+  // unless sticky, in which case marked objects become old.
+  // Return false if no slot is marked and the block can be freed.
+  // At most limit slots are swept and the block is swept when
+  // swept_ is set.
+  bool sweep (FreeLists* free_lists, bool sticky = false, size_t limit = SIZE_MAX);
+  // Reset the marks of old objects and clean the cards.
+  void reset_marks ();
+  // Reset the marks of at most limit slots starting at *slot.
+  // Return true when the block is done.
+  bool reset_marks (size_t* slot, size_t limit);
+  void clean_cards ();
+  // Record that an object allocated while marking is marked and
+  // scanned, and dirty its cards so it is scanned when the collection
+  // finishes.
+  void allocate_marked (void* address, size_t size);
+  // Record a store of size bytes at address.
+  void dirty (void* address, size_t size);
+  // Scan the old objects on at most limit cards starting at *card
+  // and clean the cards.  Return true when the block is done.
+  bool scan_cards (Heap* heap, Block** work_list, size_t* card, size_t limit);
   void* begin () const;
+  size_t size () const;
+  Block* link () const;
   bool is_object (void* address) const;
   bool is_allocated (void* address) const;
   void set_mark ()
@@ -40,27 +182,55 @@ struct Block
 #endif
 
 private:
-  Block (size_t bits_bytes);
-  static Block* remove_right_most (Block** b);
+  Block (size_t bits_bytes, size_t card_bytes);
+  // Reset the block to a fresh state with bytes of status bits and cards.
+  void clear (size_t bytes);
+  // Record the block in the page map for its pages or forget it.
+  void map (bool flag);
   size_t slot (void* address) const;
   void set_bits (size_t slot, unsigned char mask);
   void reset_bits (size_t slot, unsigned char mask);
   void clear_bits (size_t slot);
   unsigned char get_bits (size_t slot) const;
-  void scan (Heap* heap, Block** work_list);
+  size_t object_end (size_t slot) const;
+  // Scan at most limit slots and put the block back on the work list
+  // if slots remain.
+  void scan (Heap* heap, Block** work_list, size_t limit);
 
-  // Blocks are organized into a tree sorted by begin.
-  Block* left_;
-  Block* right_;
+  // The heap that owns the block.  Read without a lock when a
+  // collector finds the block of an address.
+  Heap* heap_;
+  // The blocks of a heap are organized into a list.
+  Block* link_;
   // Blocks are also organized into a set/list when collecting garbage.
   Block* next_;
   // Beginning and end of the storage for this block.
+  // The storage is aligned to a page and is a whole number of pages.
   void* begin_;
   void* end_;
+  // Slots marked since the last scan are in [scan_begin_, scan_end_).
+  size_t scan_begin_;
+  size_t scan_end_;
   // Indicates that at least one slot is marked.
   bool marked_;
+  // Indicates that unmarked slots have been returned to the free
+  // lists.  Until then, only marked slots are allocated.
+  bool swept_;
+  // The slots before sweep_slot_ have been swept.  The free run that
+  // ends there begins at sweep_free_ or sweep_free_ is SIZE_MAX.
+  size_t sweep_slot_;
+  size_t sweep_free_;
+  // Indicates that at least one card is dirty.
+  bool dirty_;
+  // Indicates that the objects of the block are being moved.
+  bool evacuate_;
+  // One byte per card that is set when a pointer is stored on the card.
+  // The cards follow the status bits.
+  unsigned char* cards_;
   // Status bits.
-  unsigned char bits_[];
+  unsigned char* bits_;
+
+  friend class Heap;
 };
 
 struct Heap
@@ -74,9 +244,62 @@ struct Heap
   ~Heap ();
   // Return the root of the heap.
   void* root () const;
-  // Allocate size bytes.
-  void* allocate (size_t size);
+  // Allocate size bytes.  The collector only follows the pointers
+  // given by the pointer map.  Every word is a potential pointer if
+  // the pointer map is NULL.
+  void* allocate (size_t size, const PointerMap* pointer_map = NULL);
+  // Allocate size bytes without clearing them.  The caller must
+  // write all size bytes before the heap is used again.
+  void* allocate_uninitialized (size_t size, const PointerMap* pointer_map = NULL);
+  // Collect garbage if enough has been allocated since the last
+  // collection.  A generational heap only marks the objects allocated
+  // since the last collection unless force is true or the old
+  // objects have grown enough to warrant a full collection.
   bool collect_garbage (bool force = false);
+  // Collect garbage and move the objects of sparse blocks into a new
+  // block so the sparse blocks are released.  Only the pointers named
+  // by pointer maps are updated, so objects referenced from the roots
+  // or from objects without pointer maps do not move.  Return true if
+  // an object moved.
+  bool compact ();
+  // Return true if the policy allows compaction and the heap has been
+  // collected since it was last compacted.
+  bool wants_compaction () const;
+  // Keep a young generation.  Objects that survive a collection
+  // become old and are only collected by a full collection.  Stores of
+  // pointers into the heap must call write_barrier.
+  void generational (bool flag);
+  bool generational () const;
+  // Make heaps constructed from now on generational.
+  static void generational_default (bool flag);
+  // Record a store of size bytes at address so that a minor collection
+  // finds pointers from old objects to young objects and an
+  // incremental collection finds pointers stored while marking.
+  // Addresses outside of every heap are ignored.
+  static void write_barrier (void* address, size_t size);
+  // Set the policy of the heap.  Children inherit the policy when
+  // they are inserted.
+  void policy (const GcPolicy& policy);
+  const GcPolicy& policy () const;
+  // Set the policy of heaps constructed from now on.
+  static void policy_default (const GcPolicy& policy);
+  // Start count threads that help collect the children of heaps.
+  // Children are disjoint so they are collected independently.  The
+  // thread collecting the parent collects children too and waits for
+  // the helpers before it finishes.
+  static void collector_threads (size_t count);
+  // Return true if a collection has started and not finished.
+  bool collecting () const;
+  // Return true if this heap or one of its descendants has allocated
+  // past its threshold, or is collecting, since collect_garbage last
+  // ran.  Allocation sets the flag so a scheduler only runs
+  // collect_garbage when there is work to do.
+  bool wants_collection () const;
+  // Elide the mutex of the heap while flag is true.  A scheduler sets
+  // the flag while it holds the write lock of the component that owns
+  // the heap, since then no other thread uses the heap.
+  void exclusive (bool flag);
+  bool exclusive () const;
   // Merge x into this heap.
   void merge (Heap* x);
   void insert_child (Heap* child);
@@ -88,16 +311,31 @@ struct Heap
   bool is_object (void* ptr);
   bool is_allocated (void* ptr);
   bool is_child (Heap* child);
+  // Add the counters of this heap and its descendants to stats.  The
+  // heap must not be in use.
+  void stats (HeapStats* stats) const;
 
 private:
-  // The root block of this heap.
+  // The blocks of this heap.
   Block* block_;
+  // Blocks that have been marked but not swept.
+  Block* unswept_;
 
   // Lock for this heap.
   pthread_mutex_t mutex_;
 
-  // List of free chunks.
-  Chunk* free_list_head_;
+  // Free chunks.
+  FreeLists free_lists_;
+
+  // Objects are allocated by bumping span_next_ toward span_limit_.
+  // The slots in [span_begin_, span_next_) are not yet recorded as
+  // allocated in span_block_.
+  Block* span_block_;
+  char* span_begin_;
+  char* span_next_;
+  char* span_limit_;
+  // The span has not been written since its block was made.
+  bool span_zero_;
 
   // Number of bytes allocated in this heap.
   size_t allocated_size_;
@@ -106,6 +344,60 @@ private:
   // Size when next collection will be triggered (bytes).
   size_t next_collection_size_;
 
+  // Indicates that the heap has a young generation.
+  bool generational_;
+  // Indicates that the next collection must be a full collection.
+  bool full_;
+  // Indicates that a block may have been swept without resetting its
+  // marks.
+  bool sticky_;
+  // Number of bytes that survived the last collection.
+  size_t live_size_;
+  // Size of the old objects when the next full collection will be
+  // triggered (bytes).
+  size_t next_full_size_;
+
+  // When the heap is collected.
+  GcPolicy policy_;
+  // Set when collect_garbage should run.
+  bool requested_;
+  // The steps of a collection.
+  enum Phase
+  {
+    Idle,
+    // Finish sweeping so that only marked objects are allocated.
+    Sweeping,
+    // Reset the marks of old objects for a full collection.
+    Resetting,
+    // Scan the work list and, for a minor collection, the cards.
+    Marking,
+    // Scan the roots and dirty cards until they add no work.
+    Rescanning
+  };
+  Phase phase_;
+  // The next block to reset or whose cards to scan, and the slot or
+  // card in it.
+  Block* cursor_;
+  size_t cursor_index_;
+  // Number of passes over the cards while rescanning.
+  size_t rescans_;
+  // Indicates that marking has started and not finished.
+  // Objects are allocated marked until it finishes.
+  bool marking_;
+  // Indicates that the current collection is a minor collection.
+  bool minor_;
+  // Objects referenced by conservatively scanned words are pinned.
+  bool pinning_;
+  // A collection has left holes since the heap was last compacted.
+  bool fragmented_;
+  // Blocks with marked objects that have not been scanned.
+  Block* work_list_;
+  // The mutex is not needed.
+  bool exclusive_;
+  // Counters maintained while the heap is used.  The block counts are
+  // computed when the counters are read.
+  HeapStats stats_;
+
   // The beginning and end of the root of the heap.  For a statically
   // allocated component, they refer to a chunk in the parent
   // component.  For a child heap, they refer to a chunk in the
@@ -116,12 +408,56 @@ private:
   // The pointers for a tree of heaps.
   Heap* child_;
   Heap* next_;
+  // The link that points to this heap so it is removed in constant
+  // time.
+  Heap** prev_;
   Heap* parent_;
   // Flag indicating heap was reachable during garbage collection.
   bool reachable_;
 
   void scan (void* begin, void* end, Block** work_list);
-  void mark_slot_for_address (void* p, Block** work_list);
+  void mark_slot_for_address (void* p, Block** work_list, bool pin = false);
+  void* allocate_object (size_t size, const PointerMap* pointer_map, bool zero);
+  void* allocate_i (size_t size, Block** block, bool* zero);
+  void scan_units (void* begin, void* end, Block** work_list);
+  void set_span (Block* block, void* begin, size_t size, bool zero);
+  void flush_span ();
+  void retire_span ();
+  // Sweep at most limit slots of an unswept block.  Return false if
+  // no block is unswept.
+  bool sweep_block (size_t limit = SIZE_MAX);
+  void reset_marks ();
+  bool collect (bool force, const struct timespec* deadline);
+  // Advance the collection until it is ready to finish or the
+  // deadline passes.  Return true if it is ready to finish.
+  bool advance (bool force, const struct timespec* deadline);
+  void begin_marking ();
+  // Scan at most limit cards at the cursor.
+  void scan_cards (size_t limit);
+  // Return true if a block has a dirty card.
+  bool dirty () const;
+  void finish_collection (const struct timespec* deadline);
+  void abandon_collection ();
+  // Move the unpinned objects of sparse blocks and update the pointers
+  // to them.  Return true if an object moved.
+  bool evacuate ();
+  // Return the new address of a moved object.
+  void* forward (void* p) const;
+  // Collect the children in parallel if there are helpers.  Return
+  // true if some child collected garbage.
+  bool collect_children (const struct timespec* deadline);
+  static Heap* claim_child (ChildBatch** batch);
+  static void collect_child (ChildBatch* batch, Heap* child);
+  static void* collector_main (void* arg);
+  void lock ();
+  void unlock ();
+  // Add the time since begin to the pause counters.
+  void end_pause (const struct timespec& begin);
+  // Set the flag of this heap and its ancestors.
+  void request ();
+  // Return the allocation threshold after a collection with size
+  // live bytes.
+  size_t threshold (size_t size) const;
 
 #ifndef COVERAGE
   void dump_i () const;
@@ -26,6 +26,7 @@ instance_scheduler_t::lock (const InstanceSet& set)
           break;
         case AccessWrite:
           pthread_rwlock_wrlock (&record->lock);
+          record->heap ()->exclusive (true);
           break;
         }
     }
@@ -44,7 +45,10 @@ instance_scheduler_t::unlock (const InstanceSet& set)
         case AccessNone:
           break;
         case AccessRead:
+          pthread_rwlock_unlock (&record->lock);
+          break;
         case AccessWrite:
+          record->heap ()->exclusive (false);
           pthread_rwlock_unlock (&record->lock);
           break;
         }
@@ -118,18 +122,36 @@ instance_scheduler_t::instance_executor_t::run_i ()
       for (composition::ActionsType::const_iterator pos = record->instance ()->actions.begin (),
            limit = record->instance ()->actions.end ();
            pos != limit;
-           ++pos)
+           pos += (*pos)->batch_size)
         {
           const Action* action = *pos;
           scheduler_.lock (action->instance_set ());
-          this->execute (action);
+          if (action->batch_size == 1)
+            {
+              this->execute (action);
+            }
+          else
+            {
+              this->execute (&*pos, action->batch_size);
+            }
           scheduler_.unlock (action->instance_set ());
         }
 
-      // Collect garbage.
+      // Collect garbage if an allocation crossed the threshold.
       pthread_rwlock_wrlock (&record->lock);
-      this->collect_garbage (record);
+      if (record->heap ()->wants_collection ())
+        {
+          record->heap ()->exclusive (true);
+          this->collect_garbage (record);
+          record->heap ()->exclusive (false);
+        }
+      // An incremental collection continues at the next visit.
+      const bool again = record->heap ()->wants_collection ();
       pthread_rwlock_unlock (&record->lock);
+      if (again)
+        {
+          scheduler_.push (record);
+        }
 
       pthread_mutex_lock (&scheduler_.list_mutex_);
       --scheduler_.pending_;
@@ -5,6 +5,7 @@
 
 #include <cstdlib>
 #include <cassert>
+#include <cctype>
 
 #include "config.h"
 #include "scanner.hpp"
@@ -17,8 +18,10 @@
 #include "instance_scheduler.hpp"
 #include "partitioned_scheduler.hpp"
 #include "generate_code.hpp"
+#include "heap.hpp"
 #include "check_types.hpp"
 #include "compute_receiver_access.hpp"
+#include "compute_field_access.hpp"
 #include "enter_predeclared_identifiers.hpp"
 #include "enter_top_level_identifiers.hpp"
 #include "enter_method_identifiers.hpp"
@@ -50,11 +53,32 @@ try_help (void)
 #define SRAND_OPTION 258
 #define PROFILE_OPTION 259
 #define PROFILE_OUT_OPTION 260
+#define INLINE_THRESHOLD_OPTION 261
+#define EMIT_CXX_OPTION 262
+#define GC_BUDGET_OPTION 263
+#define GC_GROWTH_OPTION 264
+#define GC_MIN_HEAP_OPTION 265
 
 int
 main (int argc, char **argv)
 {
   int show_composition = 0;
+  int bytecode = 0;
+  int fuse = 1;
+  int fusion_report = 0;
+  int fold = 1;
+  int hoist = 1;
+  int stack_allocate = 1;
+  int native = 0;
+  int precondition_cache = 1;
+  int batch = 1;
+  int generational = 0;
+  int gc_compact = 0;
+  unsigned long gc_budget = 0;
+  double gc_growth = 2;
+  size_t gc_min_heap = 0;
+  std::string emit_cxx;
+  size_t inline_threshold = code::Options ().inline_threshold;
   int thread_count = 2;
   std::string scheduler_type = "partitioned";
   // Profile stores the number of points to record per thread.
@@ -76,12 +100,28 @@ main (int argc, char **argv)
         {"version",     no_argument, NULL, 'v'},
 
         {"composition", no_argument, &show_composition, 1},
+        {"bytecode",    no_argument, &bytecode, 1},
+        {"no-fuse",     no_argument, &fuse, 0},
+        {"fusion-report", no_argument, &fusion_report, 1},
+        {"no-fold",     no_argument, &fold, 0},
+        {"no-hoist",    no_argument, &hoist, 0},
+        {"no-stack-allocate", no_argument, &stack_allocate, 0},
+        {"native",      no_argument, &native, 1},
+        {"no-precondition-cache", no_argument, &precondition_cache, 0},
+        {"no-batch",    no_argument, &batch, 0},
+        {"generational", no_argument, &generational, 1},
+        {"gc-compact",  no_argument, &gc_compact, 1},
 
         {"scheduler",   required_argument, NULL, SCHEDULER_OPTION},
         {"threads",     required_argument, NULL, THREADS_OPTION},
         {"srand",       required_argument, NULL, SRAND_OPTION},
         {"profile",     optional_argument, NULL, PROFILE_OPTION},
         {"profile-out", required_argument, NULL, PROFILE_OUT_OPTION},
+        {"inline-threshold", required_argument, NULL, INLINE_THRESHOLD_OPTION},
+        {"emit-cxx",    required_argument, NULL, EMIT_CXX_OPTION},
+        {"gc-budget",   required_argument, NULL, GC_BUDGET_OPTION},
+        {"gc-growth",   required_argument, NULL, GC_GROWTH_OPTION},
+        {"gc-min-heap", required_argument, NULL, GC_MIN_HEAP_OPTION},
 
         {0, 0, 0, 0}
       };
@@ -101,6 +141,22 @@ main (int argc, char **argv)
                     "Compile " PACKAGE_NAME " source code.\n"
                     "\n"
                     "  --composition       print composition analysis and exit\n"
+                    "  --bytecode          execute bodies with the bytecode interpreter\n"
+                    "  --no-fuse           do not replace common operations with fused operations\n"
+                    "  --fusion-report     print the number of fused operations to stderr\n"
+                    "  --no-fold           do not fold constant expressions or remove dead code\n"
+                    "  --no-hoist          check every index even if a loop proves it in bounds\n"
+                    "  --no-stack-allocate allocate every new object in the heap\n"
+                    "  --inline-threshold=NUM  inline callables with at most NUM nodes, 0 turns inlining off (16)\n"
+                    "  --native            compile bodies to native code with the C++ compiler\n"
+                    "  --emit-cxx=FILE     write bodies as C++ to FILE\n"
+                    "  --no-precondition-cache  reevaluate every precondition\n"
+                    "  --no-batch          evaluate the preconditions of dimensioned actions one at a time\n"
+                    "  --generational      collect objects allocated since the last collection separately\n"
+                    "  --gc-budget=USEC    collect garbage in steps of about USEC microseconds, 0 disables (0)\n"
+                    "  --gc-growth=FACTOR  collect garbage when a heap grows by FACTOR over its live size (2)\n"
+                    "  --gc-min-heap=BYTES do not collect garbage in heaps smaller than BYTES (0)\n"
+                    "  --gc-compact        compact heaps while the program waits for input\n"
                     "  --scheduler=SCHED   select a scheduler (instance, partitioned)\n"
                     "  --threads=NUM       use NUM threads\n"
                     "  --srand=NUM         initialize the random number generator with NUM\n"
@@ -143,6 +199,33 @@ main (int argc, char **argv)
               error (EXIT_FAILURE, errno, "Could not open %s for writing", optarg);
             }
           break;
+        case INLINE_THRESHOLD_OPTION:
+          {
+            char* end;
+            errno = 0;
+            inline_threshold = strtoul (optarg, &end, 10);
+            if (!isdigit (optarg[0]) || *end != '\0' || errno != 0)
+              {
+                error (EXIT_FAILURE, 0, "--inline-threshold must be a non-negative integer");
+              }
+          }
+          break;
+        case EMIT_CXX_OPTION:
+          emit_cxx = optarg;
+          break;
+        case GC_BUDGET_OPTION:
+          gc_budget = strtoul (optarg, NULL, 0);
+          break;
+        case GC_GROWTH_OPTION:
+          gc_growth = strtod (optarg, NULL);
+          if (gc_growth < 1)
+            {
+              error (EXIT_FAILURE, 0, "--gc-growth must be at least 1");
+            }
+          break;
+        case GC_MIN_HEAP_OPTION:
+          gc_min_heap = strtoul (optarg, NULL, 0);
+          break;
 
         default:
           try_help ();
@@ -235,6 +318,10 @@ main (int argc, char **argv)
   semantic::process_top_level_declarations (root, er, file_scope);
   semantic::check_types (root, er, file_scope);
   semantic::compute_receiver_access (root);
+  if (precondition_cache)
+    {
+      semantic::compute_field_access (root);
+    }
 
   if (profile)
     {
@@ -256,7 +343,18 @@ main (int argc, char **argv)
   semantic::allocate_stack_variables (root);
 
   // Generate code.
-  code::generate_code (root);
+  code::Options code_options;
+  code_options.bytecode = bytecode;
+  code_options.fuse = fuse;
+  code_options.fusion_report = fusion_report;
+  code_options.fold = fold;
+  code_options.hoist = hoist;
+  code_options.stack_allocate = stack_allocate;
+  code_options.inline_threshold = inline_threshold;
+  code_options.emit_cxx = emit_cxx;
+  code_options.native = native;
+  code_options.write_barrier = generational || gc_budget != 0;
+  code::generate_code (root, code_options);
 
   if (profile)
     {
@@ -282,6 +380,10 @@ main (int argc, char **argv)
       return 0;
     }
   instance_table.analyze ();
+  if (batch)
+    {
+      instance_table.batch_actions ();
+    }
 
   if (profile)
     {
@@ -297,6 +399,14 @@ main (int argc, char **argv)
       fprintf (profile_out, "BEGIN scheduler_init %ld.%.09ld\n", res.tv_sec, res.tv_nsec);
     }
 
+  runtime::Heap::generational_default (generational);
+  runtime::GcPolicy gc_policy;
+  gc_policy.growth = gc_growth;
+  gc_policy.min_size = gc_min_heap;
+  gc_policy.compact = gc_compact;
+  gc_policy.pause_budget = gc_budget * 1000;
+  runtime::Heap::policy_default (gc_policy);
+  runtime::Heap::collector_threads (thread_count > 1 ? thread_count - 1 : 0);
   runtime::allocate_instances (instance_table);
   runtime::create_bindings (instance_table);
 
@@ -347,6 +457,7 @@ main (int argc, char **argv)
 
   if (profile)
     {
+      runtime::print_heap_profile (profile_out, instance_table);
       fprintf (profile_out, "END profile\n");
     }
 
@@ -36,6 +36,15 @@ void MemoryModel::locals_pop (size_t size)
   locals_offset_ -= util::align_up (size, arch::stack_alignment ());
 }
 
+void MemoryModel::locals_reserve (size_t size)
+{
+  size = util::align_up (size, arch::stack_alignment ());
+  if (size > locals_size_on_stack_)
+    {
+      locals_size_on_stack_ = size;
+    }
+}
+
 ptrdiff_t MemoryModel::arguments_offset () const
 {
   return arguments_offset_;
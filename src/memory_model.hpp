@@ -26,6 +26,8 @@ public:
   bool locals_empty () const;
   void locals_push (const type::Type* type);
   void locals_pop (size_t size);
+  // Grow the locals area to at least size bytes.
+  void locals_reserve (size_t size);
   ptrdiff_t arguments_offset () const;
   ptrdiff_t locals_offset () const;
   size_t locals_size_on_stack () const;
@@ -0,0 +1,492 @@
+#include "native.hpp"
+
+#include <error.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "native_emit.hpp"
+#include "operation.hpp"
+#include "callable.hpp"
+
+// The compiler and the directory of the installed runtime headers used
+// to build native code.  These are set by the build system and can be
+// overridden with RC_CXX and RC_NATIVE_INCLUDEDIR.
+#ifndef RC_NATIVE_CXX
+#define RC_NATIVE_CXX "c++"
+#endif
+
+#ifndef RC_NATIVE_INCLUDEDIR
+#define RC_NATIVE_INCLUDEDIR "/usr/local/include/reactive-components-for-go"
+#endif
+
+namespace runtime
+{
+
+Control
+Native::execute (ExecutorBase& exec) const
+{
+  if (function != NULL)
+    {
+      return function (exec);
+    }
+  return root->execute (exec);
+}
+
+void
+Native::dump () const
+{
+  std::cout << "Native(";
+  root->dump ();
+  std::cout << ")";
+}
+
+Native*
+NativeModule::add (const Operation* root)
+{
+  Native* n = new Native (root);
+  ids_[n] = natives_.size ();
+  natives_.push_back (n);
+  return n;
+}
+
+const char*
+native_type (const std::type_info& type)
+{
+  if (type == typeid (bool))
+    {
+      return "bool";
+    }
+  if (type == typeid (signed char))
+    {
+      return "signed char";
+    }
+  if (type == typeid (unsigned char))
+    {
+      return "unsigned char";
+    }
+  if (type == typeid (short))
+    {
+      return "short";
+    }
+  if (type == typeid (unsigned short))
+    {
+      return "unsigned short";
+    }
+  if (type == typeid (int))
+    {
+      return "int";
+    }
+  if (type == typeid (unsigned int))
+    {
+      return "unsigned int";
+    }
+  if (type == typeid (long))
+    {
+      return "long";
+    }
+  if (type == typeid (unsigned long))
+    {
+      return "unsigned long";
+    }
+  if (type == typeid (long long))
+    {
+      return "long long";
+    }
+  if (type == typeid (unsigned long long))
+    {
+      return "unsigned long long";
+    }
+  if (type == typeid (float))
+    {
+      return "float";
+    }
+  if (type == typeid (double))
+    {
+      return "double";
+    }
+  return NULL;
+}
+
+template <typename T>
+static bool
+integer_literal (std::ostream& out, const std::type_info& type, const void* value)
+{
+  if (type != typeid (T))
+    {
+      return false;
+    }
+  out << "static_cast<" << native_type (type) << "> ("
+      << static_cast<unsigned long long> (*static_cast<const T*> (value)) << "ULL)";
+  return true;
+}
+
+// Floating-point literals round trip with 17 significant digits.
+template <typename T>
+static bool
+float_literal (std::ostream& out, const std::type_info& type, const void* value)
+{
+  if (type != typeid (T))
+    {
+      return false;
+    }
+  const T x = *static_cast<const T*> (value);
+  if (!std::isfinite (x))
+    {
+      return false;
+    }
+  std::ostringstream str;
+  str << std::setprecision (17) << static_cast<double> (x);
+  out << "static_cast<" << native_type (type) << "> (" << str.str () << ")";
+  return true;
+}
+
+bool
+native_literal (std::ostream& out, const std::type_info& type, const void* value)
+{
+  return integer_literal<bool> (out, type, value) ||
+         integer_literal<signed char> (out, type, value) ||
+         integer_literal<unsigned char> (out, type, value) ||
+         integer_literal<short> (out, type, value) ||
+         integer_literal<unsigned short> (out, type, value) ||
+         integer_literal<int> (out, type, value) ||
+         integer_literal<unsigned int> (out, type, value) ||
+         integer_literal<long> (out, type, value) ||
+         integer_literal<unsigned long> (out, type, value) ||
+         integer_literal<long long> (out, type, value) ||
+         integer_literal<unsigned long long> (out, type, value) ||
+         float_literal<float> (out, type, value) ||
+         float_literal<double> (out, type, value);
+}
+
+void
+native_string (std::ostream& out, const std::string& str)
+{
+  out << '"';
+  for (std::string::const_iterator pos = str.begin (), limit = str.end ();
+       pos != limit;
+       ++pos)
+    {
+      const unsigned char c = *pos;
+      if (c == '"' || c == '\\')
+        {
+          out << '\\' << c;
+        }
+      else if (c < ' ' || c >= 0x7F)
+        {
+          const char* digits = "01234567";
+          out << '\\' << digits[c >> 6] << digits[(c >> 3) & 7] << digits[c & 7];
+        }
+      else
+        {
+          out << c;
+        }
+    }
+  out << '"';
+}
+
+size_t
+NativeModule::data_index (const void* data)
+{
+  data_.push_back (data);
+  return data_.size () - 1;
+}
+
+void
+NativeModule::write (std::ostream& out)
+{
+  data_.clear ();
+  functions_.clear ();
+
+  out << "// Generated by rcgo.\n"
+      << "#include <error.h>\n"
+      << "\n"
+      << "#include \"executor_base.hpp\"\n"
+      << "#include \"operation.hpp\"\n"
+      << "#include \"callable.hpp\"\n"
+      << "#include \"heap.hpp\"\n"
+      << "\n"
+      << "namespace\n"
+      << "{\n"
+      << "const void* const* rc_data;\n"
+      << "const runtime::ApplyFunction* rc_functions;\n"
+      << "}\n"
+      << "\n"
+      << "extern \"C\"\n"
+      << "{\n"
+      << "void rc_native_init (const void* const* data, const runtime::ApplyFunction* functions)\n"
+      << "{\n"
+      << "  rc_data = data;\n"
+      << "  rc_functions = functions;\n"
+      << "}\n";
+
+  for (size_t id = 0; id != natives_.size (); ++id)
+    {
+      out << "runtime::Control rc_native_" << id << " (runtime::ExecutorBase& exec);\n";
+    }
+
+  for (size_t id = 0; id != natives_.size (); ++id)
+    {
+      Compiler compiler;
+      natives_[id]->root->compile (compiler);
+      compiler.emit (Op_End);
+      translate (out, id, compiler.code ());
+    }
+
+  out << "}\n";
+}
+
+void
+NativeModule::translate (std::ostream& out, size_t id, const Compiler::CodeType& code)
+{
+  std::set<size_t> targets;
+  for (size_t idx = 0; idx != code.size (); ++idx)
+    {
+      switch (code[idx].opcode)
+        {
+        case Op_Jump:
+        case Op_Jump_If_False:
+        case Op_Jump_If_True_Or_Pop:
+        case Op_Jump_If_False_Or_Pop:
+          targets.insert (code[idx].offset);
+          break;
+        default:
+          break;
+        }
+    }
+
+  out << "\n"
+      << "runtime::Control rc_native_" << id << " (runtime::ExecutorBase& exec)\n"
+      << "{\n"
+      << "  runtime::Stack& stack = exec.stack ();\n";
+
+  for (size_t idx = 0; idx != code.size (); ++idx)
+    {
+      const Instruction& i = code[idx];
+      if (targets.count (idx) != 0)
+        {
+          out << "L" << idx << ":\n";
+        }
+
+      switch (i.opcode)
+        {
+        case Op_Execute:
+        {
+          const Native* n = dynamic_cast<const Native*> (i.operation);
+          std::map<const Native*, size_t>::const_iterator pos = n ? ids_.find (n) : ids_.end ();
+          out << "  if (";
+          if (pos != ids_.end ())
+            {
+              out << "rc_native_" << pos->second << " (exec)";
+            }
+          else
+            {
+              out << "static_cast<const runtime::Operation*> (rc_data[" << data_index (i.operation) << "])->execute (exec)";
+            }
+          out << " == runtime::Control_Return) return runtime::Control_Return;\n";
+        }
+        break;
+        case Op_Apply:
+          if (!i.operation->emit_native (out))
+            {
+              functions_.push_back (i.function);
+              out << "  rc_functions[" << functions_.size () - 1 << "] (exec, static_cast<const runtime::Operation*> (rc_data[" << data_index (i.operation) << "]));\n";
+            }
+          break;
+        case Op_Push_Address:
+          out << "  stack.push_address (" << i.offset << ");\n";
+          break;
+        case Op_Push_Bytes:
+          out << "  stack.load<" << i.size << "> (rc_data[" << data_index (i.data) << "]);\n";
+          break;
+        case Op_Load:
+          out << "  stack.load<" << i.size << "> (stack.pop_pointer ());\n";
+          break;
+        case Op_Select:
+          out << "  stack.push_pointer (static_cast<char*> (stack.pop_pointer ()) + " << i.offset << ");\n";
+          break;
+        case Op_Assign:
+          out << "  stack.store_indirect (" << i.size << ");\n";
+          break;
+        case Op_Assign_Barrier:
+          out << "  runtime::Heap::write_barrier (stack.store_indirect (" << i.size << "), " << i.size << ");\n";
+          break;
+        case Op_Clear:
+          out << "  stack.clear (" << i.offset << ", " << i.size << ");\n";
+          break;
+        case Op_Popn:
+          out << "  stack.popn (" << i.size << ");\n";
+          break;
+        case Op_Reserve:
+          out << "  stack.reserve (" << i.size << ");\n";
+          break;
+        case Op_Call:
+          out << "  stack.push_pointer (NULL);\n"
+              << "  stack.setup (" << i.callable->memory_model.locals_size_on_stack () << ");\n"
+              << "  static_cast<const decl::Callable*> (rc_data[" << data_index (i.callable) << "])->call (exec);\n"
+              << "  stack.teardown ();\n"
+              << "  stack.pop_pointer ();\n"
+              << "  stack.popn (" << arch::size_on_stack (i.callable->parameter_list ()) << ");\n";
+          break;
+        case Op_Move:
+          out << "  stack.move<" << i.size << "> (" << i.offset << ");\n";
+          break;
+        case Op_Return:
+          out << "  return runtime::Control_Return;\n";
+          break;
+        case Op_Jump:
+          out << "  goto L" << i.offset << ";\n";
+          break;
+        case Op_Jump_If_False:
+          out << "  { bool c; stack.pop (c); if (!c) goto L" << i.offset << "; }\n";
+          break;
+        case Op_Jump_If_True_Or_Pop:
+          out << "  { bool c; stack.pop (c); if (c) { stack.push (c); goto L" << i.offset << "; } }\n";
+          break;
+        case Op_Jump_If_False_Or_Pop:
+          out << "  { bool c; stack.pop (c); if (!c) { stack.push (c); goto L" << i.offset << "; } }\n";
+          break;
+        case Op_End:
+          out << "  return runtime::Control_Continue;\n";
+          break;
+        }
+    }
+
+  out << "}\n";
+}
+
+// Remove the files written by NativeModule::load and their directory.
+static void
+remove_directory (const std::string& dir)
+{
+  unlink ((dir + "/native.cpp").c_str ());
+  unlink ((dir + "/native.so").c_str ());
+  rmdir (dir.c_str ());
+}
+
+// Compile source into the shared object.  The compiler may be given
+// with arguments, e.g., "g++ -m64", so it is split at spaces.  The
+// paths are passed as single arguments so they may contain spaces.
+static bool
+compile_shared_object (const char* cxx, const std::string& source, const std::string& object)
+{
+  const char* includedir = getenv ("RC_NATIVE_INCLUDEDIR");
+
+  std::vector<std::string> args;
+  std::istringstream words (cxx);
+  std::string word;
+  while (words >> word)
+    {
+      args.push_back (word);
+    }
+  if (args.empty ())
+    {
+      return false;
+    }
+  args.push_back ("-shared");
+  args.push_back ("-fPIC");
+  args.push_back ("-O2");
+  args.push_back (std::string ("-I") + (includedir ? includedir : RC_NATIVE_INCLUDEDIR));
+  args.push_back ("-o");
+  args.push_back (object);
+  args.push_back (source);
+
+  std::vector<char*> argv;
+  for (size_t idx = 0; idx != args.size (); ++idx)
+    {
+      argv.push_back (&args[idx][0]);
+    }
+  argv.push_back (NULL);
+
+  pid_t pid = fork ();
+  if (pid == -1)
+    {
+      return false;
+    }
+  if (pid == 0)
+    {
+      execvp (argv[0], &argv[0]);
+      _exit (127);
+    }
+
+  int status;
+  while (waitpid (pid, &status, 0) == -1)
+    {
+      if (errno != EINTR)
+        {
+          return false;
+        }
+    }
+  return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+void
+NativeModule::load ()
+{
+  const char* tmpdir = getenv ("TMPDIR");
+  std::string dir = std::string (tmpdir ? tmpdir : "/tmp") + "/rcgo-XXXXXX";
+  if (mkdtemp (&dir[0]) == NULL)
+    {
+      error (EXIT_FAILURE, errno, "Could not create a directory for native code");
+    }
+  const std::string source = dir + "/native.cpp";
+  const std::string object = dir + "/native.so";
+
+  {
+    std::ofstream out (source.c_str ());
+    write (out);
+    if (!out)
+      {
+        const int e = errno;
+        remove_directory (dir);
+        error (EXIT_FAILURE, e, "Could not write %s", source.c_str ());
+      }
+  }
+
+  const char* cxx = getenv ("RC_CXX");
+  if (cxx == NULL)
+    {
+      cxx = RC_NATIVE_CXX;
+    }
+  if (!compile_shared_object (cxx, source, object))
+    {
+      remove_directory (dir);
+      error (EXIT_FAILURE, 0, "Could not compile native code with %s", cxx);
+    }
+
+  void* handle = dlopen (object.c_str (), RTLD_NOW | RTLD_LOCAL);
+  // The shared object stays mapped after its files are removed.
+  remove_directory (dir);
+  if (handle == NULL)
+    {
+      error (EXIT_FAILURE, 0, "Could not load native code: %s", dlerror ());
+    }
+
+  typedef void (*InitFunction) (const void* const*, const ApplyFunction*);
+  InitFunction init = reinterpret_cast<InitFunction> (dlsym (handle, "rc_native_init"));
+  if (init == NULL)
+    {
+      error (EXIT_FAILURE, 0, "Could not load native code: %s", dlerror ());
+    }
+  init (data_.empty () ? NULL : &data_[0], functions_.empty () ? NULL : &functions_[0]);
+
+  for (size_t id = 0; id != natives_.size (); ++id)
+    {
+      std::stringstream name;
+      name << "rc_native_" << id;
+      natives_[id]->function = reinterpret_cast<NativeFunction> (dlsym (handle, name.str ().c_str ()));
+      if (natives_[id]->function == NULL)
+        {
+          error (EXIT_FAILURE, 0, "Could not load native code: %s", dlerror ());
+        }
+    }
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef RC_SRC_NATIVE_HPP
+#define RC_SRC_NATIVE_HPP
+
+#include "types.hpp"
+#include "bytecode.hpp"
+
+namespace runtime
+{
+
+// Translates bodies to C++, compiles them into a shared object with the
+// C++ compiler, and loads it.  Each body becomes a function that
+// manipulates the same Stack as the interpreter.  Arithmetic,
+// comparisons, and indexing are written inline.  Other instructions refer
+// to run-time objects (operations, callables, literals) through tables
+// that are passed to the shared object when it is loaded.
+class NativeModule
+{
+public:
+  // Register an operation tree and return the operation that runs it.
+  Native* add (const Operation* root);
+
+  // Write the C++ source for all registered operations.
+  void write (std::ostream& out);
+
+  // Compile the C++ source, load it, and point the registered
+  // operations at the native functions.  Exits on failure.
+  void load ();
+
+private:
+  size_t data_index (const void* data);
+  void translate (std::ostream& out, size_t id, const Compiler::CodeType& code);
+
+  std::vector<Native*> natives_;
+  std::map<const Native*, size_t> ids_;
+  std::vector<const void*> data_;
+  std::vector<ApplyFunction> functions_;
+};
+
+}
+
+#endif // RC_SRC_NATIVE_HPP
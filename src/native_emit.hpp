@@ -0,0 +1,26 @@
+#ifndef RC_SRC_NATIVE_EMIT_HPP
+#define RC_SRC_NATIVE_EMIT_HPP
+
+#include <iosfwd>
+#include <string>
+#include <typeinfo>
+
+namespace runtime
+{
+
+// Helpers for Operation::emit_native.  Defined in native.cpp.
+
+// The spelling of a value type in native code or NULL if it has none.
+const char* native_type (const std::type_info& type);
+
+// Write the value of the given type as a literal.  Returns false and
+// writes nothing if the type has no spelling or the value cannot be
+// written exactly.
+bool native_literal (std::ostream& out, const std::type_info& type, const void* value);
+
+// Write str as a string literal.
+void native_string (std::ostream& out, const std::string& str);
+
+}
+
+#endif // RC_SRC_NATIVE_EMIT_HPP
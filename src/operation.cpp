@@ -1,10 +1,13 @@
 #include "operation.hpp"
 
 #include <error.h>
+#include <map>
+#include <sstream>
 
 #include "callable.hpp"
 #include "composition.hpp"
 #include "heap.hpp"
+#include "native_emit.hpp"
 
 namespace runtime
 {
@@ -15,39 +18,227 @@ using namespace semantic;
 struct heap_link_t
 {
   Heap* heap;
-  pthread_mutex_t mutex;
+  // Number of changes in progress or MOVING while the link is being
+  // broken.  Only accessed atomically.
   size_t change_count;
 };
 
+// A move or merge owns the link while the count is MOVING.
+#define MOVING SIZE_MAX
+
+// Enter a change of the heap of the link.
+static void
+begin_change (heap_link_t* hl)
+{
+  size_t count = __atomic_load_n (&hl->change_count, __ATOMIC_ACQUIRE);
+  for (;;)
+    {
+      if (count == MOVING)
+        {
+          // Wait for the move to finish.
+          count = __atomic_load_n (&hl->change_count, __ATOMIC_ACQUIRE);
+        }
+      else if (__atomic_compare_exchange_n (&hl->change_count, &count, count + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+          return;
+        }
+    }
+}
+
+static void
+end_change (heap_link_t* hl)
+{
+  __atomic_sub_fetch (&hl->change_count, 1, __ATOMIC_RELEASE);
+}
+
+// Break the link and return its heap or return NULL if the link is
+// broken or a change is in progress.
+static Heap*
+break_link (heap_link_t* hl)
+{
+  size_t count = 0;
+  if (!__atomic_compare_exchange_n (&hl->change_count, &count, MOVING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      return NULL;
+    }
+  Heap* h = hl->heap;
+  hl->heap = NULL;
+  __atomic_store_n (&hl->change_count, 0, __ATOMIC_RELEASE);
+  return h;
+}
+
+void
+Operation::compile (Compiler& compiler) const
+{
+  compiler.emit_execute (this);
+}
+
+bool
+Operation::emit_native (std::ostream& out) const
+{
+  return false;
+}
+
+bool
+emit_native_unary (std::ostream& out, const char* op, const std::type_info& type, const std::type_info& result)
+{
+  if (native_type (type) == NULL || native_type (result) == NULL)
+    {
+      return false;
+    }
+  out << "  { " << native_type (type) << " x; stack.pop (x); stack.push (static_cast<" << native_type (result) << "> (" << op << "x)); }\n";
+  return true;
+}
+
+bool
+emit_native_binary (std::ostream& out, const char* op, const std::type_info& type, const std::type_info& result)
+{
+  if (native_type (type) == NULL || native_type (result) == NULL)
+    {
+      return false;
+    }
+  out << "  { " << native_type (type) << " y; stack.pop (y); " << native_type (type) << " x; stack.pop (x); stack.push (static_cast<" << native_type (result) << "> (x " << op << " y)); }\n";
+  return true;
+}
+
+bool
+emit_native_binary_literal (std::ostream& out, const char* op, const std::type_info& type, const std::type_info& result, const void* value)
+{
+  std::ostringstream literal;
+  if (native_type (type) == NULL || native_type (result) == NULL || !native_literal (literal, type, value))
+    {
+      return false;
+    }
+  out << "  { " << native_type (type) << " x; stack.pop (x); stack.push (static_cast<" << native_type (result) << "> (x " << op << " " << literal.str () << ")); }\n";
+  return true;
+}
+
+bool
+emit_native_shift (std::ostream& out, const char* op, const std::type_info& type)
+{
+  if (native_type (type) == NULL)
+    {
+      return false;
+    }
+  out << "  { unsigned long y; stack.pop (y); " << native_type (type) << " x; stack.pop (x); stack.push (static_cast<" << native_type (type) << "> (x " << op << " y)); }\n";
+  return true;
+}
+
 Control
 Load::execute (ExecutorBase& exec) const
 {
   child->execute (exec);
   void* ptr = exec.stack ().pop_pointer ();
-  exec.stack ().load (ptr, arch::size (type));
+  exec.stack ().load (ptr, size);
   return Control_Continue;
 }
 
+void
+Load::compile (Compiler& compiler) const
+{
+  child->compile (compiler);
+  compiler.emit_size (Op_Load, size);
+}
 
-Control
-IndexSlice::execute (ExecutorBase& exec) const
+template <size_t N>
+struct SizedLoad : public Load
 {
-  base->execute (exec);
-  runtime::Slice s;
-  exec.stack ().pop (s);
-  index->execute (exec);
+  SizedLoad (const Operation* c, const type::Type* t) : Load (c, t) { }
+  virtual Control execute (ExecutorBase& exec) const
+  {
+    child->execute (exec);
+    exec.stack ().load<N> (exec.stack ().pop_pointer ());
+    return Control_Continue;
+  }
+};
+
+Operation*
+make_load (const Operation* child, const type::Type* type)
+{
+  switch (arch::size (type))
+    {
+    case 1:
+      return new SizedLoad<1> (child, type);
+    case 2:
+      return new SizedLoad<2> (child, type);
+    case 4:
+      return new SizedLoad<4> (child, type);
+    case 8:
+      return new SizedLoad<8> (child, type);
+    case 16:
+      return new SizedLoad<16> (child, type);
+    case 24:
+      return new SizedLoad<24> (child, type);
+    default:
+      return new Load (child, type);
+    }
+}
+
+static void
+index_slice (ExecutorBase& exec, const Operation* operation)
+{
+  const IndexSlice* op = static_cast<const IndexSlice*> (operation);
   long i;
   exec.stack ().pop (i);
+  runtime::Slice s;
+  exec.stack ().pop (s);
 
   if (i < 0 || static_cast<unsigned long> (i) >= s.length)
     {
-      error_at_line (-1, 0, location.file.c_str (), location.line,
+      error_at_line (-1, 0, op->location.file.c_str (), op->location.line,
                      "slice index is out of bounds (E35)");
 
     }
 
-  exec.stack ().push_pointer (static_cast<char*> (s.ptr) + i * arch::unit_size (type));
+  exec.stack ().push_pointer (static_cast<char*> (s.ptr) + i * op->unit_size);
+}
+
+static void
+index_slice_unchecked (ExecutorBase& exec, const Operation* operation)
+{
+  const IndexSlice* op = static_cast<const IndexSlice*> (operation);
+  long i;
+  exec.stack ().pop (i);
+  runtime::Slice s;
+  exec.stack ().pop (s);
+  exec.stack ().push_pointer (static_cast<char*> (s.ptr) + i * op->unit_size);
+}
+
+bool
+IndexSlice::emit_native (std::ostream& out) const
+{
+  out << "  { long i; stack.pop (i); runtime::Slice s; stack.pop (s); ";
+  if (checked)
+    {
+      out << "if (i < 0 || static_cast<unsigned long> (i) >= s.length) error_at_line (-1, 0, ";
+      native_string (out, location.file);
+      out << ", " << location.line << ", \"slice index is out of bounds (E35)\"); ";
+    }
+  out << "stack.push_pointer (static_cast<char*> (s.ptr) + i * " << unit_size << "); }\n";
+  return true;
+}
+
+void
+IndexSlice::compile (Compiler& compiler) const
+{
+  base->compile (compiler);
+  index->compile (compiler);
+  compiler.emit_apply (checked ? index_slice : index_slice_unchecked, this);
+}
 
+Control
+IndexSlice::execute (ExecutorBase& exec) const
+{
+  base->execute (exec);
+  index->execute (exec);
+  if (checked)
+    {
+      index_slice (exec, this);
+    }
+  else
+    {
+      index_slice_unchecked (exec, this);
+    }
   return Control_Continue;
 }
 
@@ -58,11 +249,20 @@ struct ConvertToInt : public Operation
   Control execute (ExecutorBase& exec) const
   {
     child->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    child->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
     T in;
     exec.stack ().pop (in);
     long out = in;
     exec.stack ().push (out);
-    return Control_Continue;
   }
   virtual void dump () const
   {
@@ -187,11 +387,20 @@ struct ConvertToUint : public Operation
   Control execute (ExecutorBase& exec) const
   {
     child->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    child->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
     T in;
     exec.stack ().pop (in);
     unsigned long out = in;
     exec.stack ().push (out);
-    return Control_Continue;
   }
   virtual void dump () const
   {
@@ -269,6 +478,24 @@ LogicAnd::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+LogicOr::compile (Compiler& compiler) const
+{
+  left->compile (compiler);
+  size_t jump = compiler.emit_jump (Op_Jump_If_True_Or_Pop);
+  right->compile (compiler);
+  compiler.patch (jump, compiler.here ());
+}
+
+void
+LogicAnd::compile (Compiler& compiler) const
+{
+  left->compile (compiler);
+  size_t jump = compiler.emit_jump (Op_Jump_If_False_Or_Pop);
+  right->compile (compiler);
+  compiler.patch (jump, compiler.here ());
+}
+
 Operation* make_literal (const type::Type* type, const Value& value)
 {
   assert (value.present);
@@ -297,6 +524,10 @@ Operation* make_literal (const type::Type* type, const Value& value)
       return make_literal (value.uint_value);
     case Int_Kind:
       return make_literal (value.int_value);
+    case Uintptr_Kind:
+      return make_literal (value.uintptr_value);
+    case Float32_Kind:
+      return make_literal (value.float32_value);
     case Float64_Kind:
       return make_literal (value.float64_value);
     case String_Kind:
@@ -310,6 +541,33 @@ Operation* make_literal (const type::Type* type, const Value& value)
     }
 }
 
+bool is_literal_type (const type::Type* type)
+{
+  switch (type->underlying_kind ())
+    {
+    case Bool_Kind:
+    case Uint8_Kind:
+    case Uint16_Kind:
+    case Uint32_Kind:
+    case Uint64_Kind:
+    case Int8_Kind:
+    case Int16_Kind:
+    case Int32_Kind:
+    case Int64_Kind:
+    case Uint_Kind:
+    case Int_Kind:
+    case Uintptr_Kind:
+    case Float32_Kind:
+    case Float64_Kind:
+    case String_Kind:
+    case Pointer_Kind:
+    case Slice_Kind:
+      return true;
+    default:
+      return false;
+    }
+}
+
 Control
 ListOperation::execute (ExecutorBase& exec) const
 {
@@ -326,6 +584,17 @@ ListOperation::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+ListOperation::compile (Compiler& compiler) const
+{
+  for (ListType::const_iterator pos = list.begin (), limit = list.end ();
+       pos != limit;
+       ++pos)
+    {
+      (*pos)->compile (compiler);
+    }
+}
+
 Control
 FunctionCall::execute (ExecutorBase& exec) const
 {
@@ -356,6 +625,14 @@ FunctionCall::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+FunctionCall::compile (Compiler& compiler) const
+{
+  compiler.emit_size (Op_Reserve, arch::size_on_stack (callable->return_parameter_list ()));
+  arguments->compile (compiler);
+  compiler.emit_call (callable);
+}
+
 Control
 MethodCall::execute (ExecutorBase& exec) const
 {
@@ -389,6 +666,67 @@ MethodCall::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+MethodCall::compile (Compiler& compiler) const
+{
+  compiler.emit_size (Op_Reserve, arch::size_on_stack (callable->return_parameter_list ()));
+  receiver->compile (compiler);
+  arguments->compile (compiler);
+  compiler.emit_call (callable);
+}
+
+InlineCall::InlineCall (const decl::Callable* c, Operation* r, Operation* a, Operation* b, ptrdiff_t o)
+  : callable (c)
+  , receiver (r)
+  , arguments (a)
+  , body (b)
+  , frame_offset (o)
+  , return_size (arch::size_on_stack (c->return_parameter_list ()))
+  , arguments_size (arch::size_on_stack (c->parameter_list ()))
+{ }
+
+static void
+inline_call (ExecutorBase& exec, const InlineCall* call)
+{
+  // Move the return space and arguments into the inlined frame.
+  exec.stack ().move (call->frame_offset, call->return_size + call->arguments_size);
+  // Locals are initialized by their declarations.
+  call->body->execute (exec);
+  // Push the result.
+  exec.stack ().load (exec.stack ().get_address (call->frame_offset), call->return_size);
+}
+
+static void
+apply_inline_call (ExecutorBase& exec, const Operation* operation)
+{
+  inline_call (exec, static_cast<const InlineCall*> (operation));
+}
+
+Control
+InlineCall::execute (ExecutorBase& exec) const
+{
+  exec.stack ().reserve (return_size);
+  if (receiver)
+    {
+      receiver->execute (exec);
+    }
+  arguments->execute (exec);
+  inline_call (exec, this);
+  return Control_Continue;
+}
+
+void
+InlineCall::compile (Compiler& compiler) const
+{
+  compiler.emit_size (Op_Reserve, return_size);
+  if (receiver)
+    {
+      receiver->compile (compiler);
+    }
+  arguments->compile (compiler);
+  compiler.emit_apply (apply_inline_call, this);
+}
+
 Control
 DynamicPullPortCall::execute (ExecutorBase& exec) const
 {
@@ -448,6 +786,12 @@ Clear::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+Clear::compile (Compiler& compiler) const
+{
+  compiler.emit_offset_size (Op_Clear, offset, size);
+}
+
 Control
 Assign::execute (ExecutorBase& exec) const
 {
@@ -458,6 +802,69 @@ Assign::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+Assign::compile (Compiler& compiler) const
+{
+  left->compile (compiler);
+  right->compile (compiler);
+  compiler.emit_size (Op_Assign, size);
+}
+
+Control
+BarrierAssign::execute (ExecutorBase& exec) const
+{
+  left->execute (exec);
+  void* ptr = exec.stack ().pop_pointer ();
+  right->execute (exec);
+  exec.stack ().store (ptr, size);
+  Heap::write_barrier (ptr, size);
+  return Control_Continue;
+}
+
+void
+BarrierAssign::compile (Compiler& compiler) const
+{
+  left->compile (compiler);
+  right->compile (compiler);
+  compiler.emit_size (Op_Assign_Barrier, size);
+}
+
+template <size_t N>
+struct SizedAssign : public Assign
+{
+  SizedAssign (Operation* l, Operation* r, const type::Type* t) : Assign (l, r, t) { }
+  virtual Control execute (ExecutorBase& exec) const
+  {
+    left->execute (exec);
+    void* ptr = exec.stack ().pop_pointer ();
+    right->execute (exec);
+    exec.stack ().store<N> (ptr);
+    return Control_Continue;
+  }
+};
+
+Operation*
+make_assign (Operation* left, Operation* right, const type::Type* type)
+{
+  switch (arch::size (type))
+    {
+    case 1:
+      return new SizedAssign<1> (left, right, type);
+    case 2:
+      return new SizedAssign<2> (left, right, type);
+    case 4:
+      return new SizedAssign<4> (left, right, type);
+    case 8:
+      return new SizedAssign<8> (left, right, type);
+    case 16:
+      return new SizedAssign<16> (left, right, type);
+    case 24:
+      return new SizedAssign<24> (left, right, type);
+    default:
+      return new Assign (left, right, type);
+    }
+}
+
 template <typename T>
 struct AddAssign : public Operation
 {
@@ -470,12 +877,22 @@ struct AddAssign : public Operation
   execute (ExecutorBase& exec) const
   {
     left->execute (exec);
-    T* ptr = static_cast<T*> (exec.stack ().pop_pointer ());
     right->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    left->compile (compiler);
+    right->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
     T v;
     exec.stack ().pop (v);
+    T* ptr = static_cast<T*> (exec.stack ().pop_pointer ());
     *ptr += v;
-    return Control_Continue;
   }
   virtual void dump () const
   {
@@ -531,6 +948,12 @@ Reference::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+Reference::compile (Compiler& compiler) const
+{
+  compiler.emit_offset (Op_Push_Address, offset);
+}
+
 Control
 Select::execute (ExecutorBase& exec) const
 {
@@ -541,23 +964,77 @@ Select::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+void
+Select::compile (Compiler& compiler) const
+{
+  base->compile (compiler);
+  compiler.emit_offset (Op_Select, offset);
+}
+
+static void
+index_array (ExecutorBase& exec, const Operation* operation)
+{
+  const IndexArray* op = static_cast<const IndexArray*> (operation);
+  long i;
+  exec.stack ().pop (i);
+  void* ptr = exec.stack ().pop_pointer ();
+  if (i < 0 || i >= op->type->dimension)
+    {
+      error_at_line (-1, 0, op->location.file.c_str (), op->location.line,
+                     "array index is out of bounds (E148)");
+    }
+  exec.stack ().push_pointer (static_cast<char*> (ptr) + i * op->unit_size);
+}
+
+static void
+index_array_unchecked (ExecutorBase& exec, const Operation* operation)
+{
+  const IndexArray* op = static_cast<const IndexArray*> (operation);
+  long i;
+  exec.stack ().pop (i);
+  void* ptr = exec.stack ().pop_pointer ();
+  exec.stack ().push_pointer (static_cast<char*> (ptr) + i * op->unit_size);
+}
+
+bool
+IndexArray::emit_native (std::ostream& out) const
+{
+  out << "  { long i; stack.pop (i); char* p = static_cast<char*> (stack.pop_pointer ()); ";
+  if (checked)
+    {
+      out << "if (i < 0 || i >= " << type->dimension << "L) error_at_line (-1, 0, ";
+      native_string (out, location.file);
+      out << ", " << location.line << ", \"array index is out of bounds (E148)\"); ";
+    }
+  out << "stack.push_pointer (p + i * " << unit_size << "); }\n";
+  return true;
+}
+
 Control
 IndexArray::execute (ExecutorBase& exec) const
 {
   base->execute (exec);
-  void* ptr = exec.stack ().pop_pointer ();
   index->execute (exec);
-  long i;
-  exec.stack ().pop (i);
-  if (i < 0 || i >= type->dimension)
+  if (checked)
     {
-      error_at_line (-1, 0, location.file.c_str (), location.line,
-                     "array index is out of bounds (E148)");
+      index_array (exec, this);
+    }
+  else
+    {
+      index_array_unchecked (exec, this);
     }
-  exec.stack ().push_pointer (static_cast<char*> (ptr) + i * arch::unit_size (type));
   return Control_Continue;
 }
 
+void
+IndexArray::compile (Compiler& compiler) const
+{
+  base->compile (compiler);
+  index->compile (compiler);
+  compiler.emit_apply (checked ? index_array : index_array_unchecked, this);
+}
+
+
 Control
 SliceArray::execute (ExecutorBase& exec) const
 {
@@ -652,6 +1129,37 @@ Return::execute (ExecutorBase& exec) const
   return Control_Return;
 }
 
+void
+Return::compile (Compiler& compiler) const
+{
+  child->compile (compiler);
+  compiler.emit_offset_size (Op_Move, return_offset, return_size);
+  compiler.emit (Op_Return);
+}
+
+void
+If::compile (Compiler& compiler) const
+{
+  condition->compile (compiler);
+  size_t false_jump = compiler.emit_jump (Op_Jump_If_False);
+  true_branch->compile (compiler);
+  size_t end_jump = compiler.emit_jump (Op_Jump);
+  compiler.patch (false_jump, compiler.here ());
+  false_branch->compile (compiler);
+  compiler.patch (end_jump, compiler.here ());
+}
+
+void
+While::compile (Compiler& compiler) const
+{
+  size_t top = compiler.here ();
+  condition->compile (compiler);
+  size_t end_jump = compiler.emit_jump (Op_Jump_If_False);
+  body->compile (compiler);
+  compiler.patch (compiler.emit_jump (Op_Jump), top);
+  compiler.patch (end_jump, compiler.here ());
+}
+
 Control
 If::execute (ExecutorBase& exec) const
 {
@@ -701,13 +1209,17 @@ Change::execute (ExecutorBase& exec) const
       // Heap link is null.
       UNIMPLEMENTED;
     }
-  pthread_mutex_lock (&hl->mutex);
-  ++hl->change_count;
-  pthread_mutex_unlock (&hl->mutex);
+  begin_change (hl);
 
   // Save the old heap.
   Heap* old_heap = exec.heap ();
-  // Set the the new heap.
+  // Set the the new heap.  The heap of the link is only reachable
+  // through the old heap so it is exclusive if the old heap is.
+  const bool exclusive = old_heap->exclusive ();
+  if (exclusive)
+    {
+      hl->heap->exclusive (true);
+    }
   exec.heap (hl->heap);
 
   char** root_value = static_cast<char**> (exec.stack ().get_address (root_offset));
@@ -718,11 +1230,13 @@ Change::execute (ExecutorBase& exec) const
   Control ca = body->execute (exec);
 
   // Restore the old heap.
+  if (exclusive)
+    {
+      hl->heap->exclusive (false);
+    }
   exec.heap (old_heap);
 
-  pthread_mutex_lock (&hl->mutex);
-  --hl->change_count;
-  pthread_mutex_unlock (&hl->mutex);
+  end_change (hl);
 
   return ca;
 }
@@ -734,9 +1248,18 @@ struct Increment : public Operation
   virtual Control execute (ExecutorBase& exec) const
   {
     child->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    child->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
     T* ptr = static_cast<T*> (exec.stack ().pop_pointer ());
     ++*ptr;
-    return Control_Continue;
   }
   virtual void dump () const
   {
@@ -752,9 +1275,18 @@ struct Decrement : public Operation
   virtual Control execute (ExecutorBase& exec) const
   {
     child->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    child->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
     T* ptr = static_cast<T*> (exec.stack ().pop_pointer ());
     --*ptr;
-    return Control_Continue;
   }
   virtual void dump () const
   {
@@ -841,6 +1373,303 @@ Operation* make_decrement (Operation* child, const type::Type* type)
     }
 }
 
+Control
+LoadLocal::execute (ExecutorBase& exec) const
+{
+  exec.stack ().load (exec.stack ().get_address (offset), size);
+  return Control_Continue;
+}
+
+void
+LoadLocal::compile (Compiler& compiler) const
+{
+  compiler.emit_offset (Op_Push_Address, offset);
+  compiler.emit_size (Op_Load, size);
+}
+
+template <size_t N>
+struct SizedLoadLocal : public LoadLocal
+{
+  SizedLoadLocal (ptrdiff_t o) : LoadLocal (o, N) { }
+  virtual Control execute (ExecutorBase& exec) const
+  {
+    exec.stack ().load<N> (exec.stack ().get_address (offset));
+    return Control_Continue;
+  }
+};
+
+Operation*
+make_load_local (ptrdiff_t offset, size_t size)
+{
+  switch (size)
+    {
+    case 1:
+      return new SizedLoadLocal<1> (offset);
+    case 2:
+      return new SizedLoadLocal<2> (offset);
+    case 4:
+      return new SizedLoadLocal<4> (offset);
+    case 8:
+      return new SizedLoadLocal<8> (offset);
+    case 16:
+      return new SizedLoadLocal<16> (offset);
+    case 24:
+      return new SizedLoadLocal<24> (offset);
+    default:
+      return new LoadLocal (offset, size);
+    }
+}
+
+Control
+FieldAddress::execute (ExecutorBase& exec) const
+{
+  exec.stack ().push_pointer (static_cast<char*> (exec.stack ().read_pointer (offset)) + field);
+  return Control_Continue;
+}
+
+void
+FieldAddress::compile (Compiler& compiler) const
+{
+  compiler.emit_offset (Op_Push_Address, offset);
+  compiler.emit_size (Op_Load, sizeof (void*));
+  compiler.emit_offset (Op_Select, field);
+}
+
+Control
+LoadField::execute (ExecutorBase& exec) const
+{
+  exec.stack ().load (static_cast<char*> (exec.stack ().read_pointer (offset)) + field, size);
+  return Control_Continue;
+}
+
+void
+LoadField::compile (Compiler& compiler) const
+{
+  compiler.emit_offset (Op_Push_Address, offset);
+  compiler.emit_size (Op_Load, sizeof (void*));
+  compiler.emit_offset (Op_Select, field);
+  compiler.emit_size (Op_Load, size);
+}
+
+template <size_t N>
+struct SizedLoadField : public LoadField
+{
+  SizedLoadField (ptrdiff_t o, ptrdiff_t f) : LoadField (o, f, N) { }
+  virtual Control execute (ExecutorBase& exec) const
+  {
+    exec.stack ().load<N> (static_cast<char*> (exec.stack ().read_pointer (offset)) + field);
+    return Control_Continue;
+  }
+};
+
+Operation*
+make_load_field (ptrdiff_t offset, ptrdiff_t field, size_t size)
+{
+  switch (size)
+    {
+    case 1:
+      return new SizedLoadField<1> (offset, field);
+    case 2:
+      return new SizedLoadField<2> (offset, field);
+    case 4:
+      return new SizedLoadField<4> (offset, field);
+    case 8:
+      return new SizedLoadField<8> (offset, field);
+    case 16:
+      return new SizedLoadField<16> (offset, field);
+    case 24:
+      return new SizedLoadField<24> (offset, field);
+    default:
+      return new LoadField (offset, field, size);
+    }
+}
+
+Control
+AssignLocal::execute (ExecutorBase& exec) const
+{
+  right->execute (exec);
+  exec.stack ().move (offset, size);
+  return Control_Continue;
+}
+
+void
+AssignLocal::compile (Compiler& compiler) const
+{
+  right->compile (compiler);
+  compiler.emit_offset_size (Op_Move, offset, size);
+}
+
+template <size_t N>
+struct SizedAssignLocal : public AssignLocal
+{
+  SizedAssignLocal (ptrdiff_t o, Operation* r) : AssignLocal (o, r, N) { }
+  virtual Control execute (ExecutorBase& exec) const
+  {
+    right->execute (exec);
+    exec.stack ().move<N> (offset);
+    return Control_Continue;
+  }
+};
+
+Operation*
+make_assign_local (ptrdiff_t offset, Operation* right, size_t size)
+{
+  switch (size)
+    {
+    case 1:
+      return new SizedAssignLocal<1> (offset, right);
+    case 2:
+      return new SizedAssignLocal<2> (offset, right);
+    case 4:
+      return new SizedAssignLocal<4> (offset, right);
+    case 8:
+      return new SizedAssignLocal<8> (offset, right);
+    case 16:
+      return new SizedAssignLocal<16> (offset, right);
+    case 24:
+      return new SizedAssignLocal<24> (offset, right);
+    default:
+      return new AssignLocal (offset, right, size);
+    }
+}
+
+Control
+AssignLiteral::execute (ExecutorBase& exec) const
+{
+  left->execute (exec);
+  memcpy (exec.stack ().pop_pointer (), right->address, right->size);
+  return Control_Continue;
+}
+
+void
+AssignLiteral::compile (Compiler& compiler) const
+{
+  left->compile (compiler);
+  compiler.emit_data (right->address, right->size);
+  compiler.emit_size (Op_Assign, right->size);
+}
+
+template <typename T, bool Field, bool Up>
+struct Step : public Operation
+{
+  Step (ptrdiff_t o, ptrdiff_t f) : offset (o), field (f) { }
+  virtual Control execute (ExecutorBase& exec) const
+  {
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation* operation)
+  {
+    const Step* op = static_cast<const Step*> (operation);
+    T* ptr;
+    if (Field)
+      {
+        ptr = reinterpret_cast<T*> (static_cast<char*> (exec.stack ().read_pointer (op->offset)) + op->field);
+      }
+    else
+      {
+        ptr = static_cast<T*> (exec.stack ().get_address (op->offset));
+      }
+    if (Up)
+      {
+        ++*ptr;
+      }
+    else
+      {
+        --*ptr;
+      }
+  }
+  virtual bool emit_native (std::ostream& out) const
+  {
+    const char* type = native_type (typeid (T));
+    if (type == NULL)
+      {
+        return false;
+      }
+    out << "  " << (Up ? "++" : "--") << "*";
+    if (Field)
+      {
+        out << "reinterpret_cast<" << type << "*> (static_cast<char*> (stack.read_pointer (" << offset << ")) + " << field << ")";
+      }
+    else
+      {
+        out << "static_cast<" << type << "*> (stack.get_address (" << offset << "))";
+      }
+    out << ";\n";
+    return true;
+  }
+  virtual void dump () const
+  {
+    UNIMPLEMENTED;
+  }
+  ptrdiff_t const offset;
+  ptrdiff_t const field;
+};
+
+template <bool Field, bool Up>
+static Operation* make_step (ptrdiff_t offset, ptrdiff_t field, const type::Type* type)
+{
+  switch (type->underlying_kind ())
+    {
+    case Uint8_Kind:
+      return new Step<uint8_t, Field, Up> (offset, field);
+    case Uint16_Kind:
+      return new Step<uint16_t, Field, Up> (offset, field);
+    case Uint32_Kind:
+      return new Step<uint32_t, Field, Up> (offset, field);
+    case Uint64_Kind:
+      return new Step<uint64_t, Field, Up> (offset, field);
+    case Int8_Kind:
+      return new Step<int8_t, Field, Up> (offset, field);
+    case Int16_Kind:
+      return new Step<int16_t, Field, Up> (offset, field);
+    case Int32_Kind:
+      return new Step<int32_t, Field, Up> (offset, field);
+    case Int64_Kind:
+      return new Step<int64_t, Field, Up> (offset, field);
+    case Float32_Kind:
+      return new Step<float, Field, Up> (offset, field);
+    case Float64_Kind:
+      return new Step<double, Field, Up> (offset, field);
+    case Complex64_Kind:
+      return new Step<Complex64, Field, Up> (offset, field);
+    case Complex128_Kind:
+      return new Step<Complex128, Field, Up> (offset, field);
+    case Uint_Kind:
+      return new Step<unsigned long, Field, Up> (offset, field);
+    case Int_Kind:
+      return new Step<long, Field, Up> (offset, field);
+    case Uintptr_Kind:
+      return new Step<size_t, Field, Up> (offset, field);
+    default:
+      TYPE_NOT_REACHED (*type);
+    }
+}
+
+Operation* make_increment_local (ptrdiff_t offset, const type::Type* type)
+{
+  return make_step<false, true> (offset, 0, type);
+}
+
+Operation* make_increment_field (ptrdiff_t offset, ptrdiff_t field, const type::Type* type)
+{
+  return make_step<true, true> (offset, field, type);
+}
+
+Operation* make_decrement_local (ptrdiff_t offset, const type::Type* type)
+{
+  return make_step<false, false> (offset, 0, type);
+}
+
+Operation* make_decrement_field (ptrdiff_t offset, ptrdiff_t field, const type::Type* type)
+{
+  return make_step<true, false> (offset, field, type);
+}
+
 Control
 Activate::execute (ExecutorBase& exec) const
 {
@@ -877,12 +1706,17 @@ static void push_port_call (ExecutorBase& exec,
 
   char* base_pointer = exec.stack ().base_pointer ();
 
+  if (port == NULL)
+    {
+      return;
+    }
+
   // Activate all the reactions bound to the port.
-  while (port != NULL)
+  for (; port->instance != NULL; ++port)
     {
       // Set up a frame.
       // Push the parameter.
-      if (port->reaction->dimension () != -1)
+      if (port->has_parameter)
         {
           exec.stack ().push<long> (port->parameter);
         }
@@ -896,14 +1730,13 @@ static void push_port_call (ExecutorBase& exec,
       // Jump to the last frame.
       exec.stack ().base_pointer (exec.mutable_phase_base_pointer ());
 
-      exec.stack ().setup (port->reaction->memory_model.locals_size_on_stack ());
+      exec.stack ().setup (port->locals_size);
 
       port->reaction->call (exec);
+      composition::invalidate (port->composition_reaction->invalidates);
 
       // Move back to our frame.
       exec.stack ().base_pointer (base_pointer);
-
-      port = port->next;
     }
 }
 
@@ -950,7 +1783,10 @@ ForIota::execute (ExecutorBase& exec) const
 
 struct ConvertStringToSliceOfBytes : public Operation
 {
-  ConvertStringToSliceOfBytes (Operation* c) : child (c) { }
+  ConvertStringToSliceOfBytes (Operation* c)
+    : child (c)
+    , pointer_map (runtime::pointer_map (&named_uint8))
+  { }
   Control
   execute (ExecutorBase& exec) const
   {
@@ -958,7 +1794,7 @@ struct ConvertStringToSliceOfBytes : public Operation
     runtime::String in;
     exec.stack ().pop (in);
     runtime::Slice out;
-    out.ptr = exec.heap ()->allocate (in.length);
+    out.ptr = exec.heap ()->allocate_uninitialized (in.length, pointer_map);
     memcpy (out.ptr, in.ptr, in.length);
     out.length = in.length;
     out.capacity = in.length;
@@ -971,11 +1807,15 @@ struct ConvertStringToSliceOfBytes : public Operation
     UNIMPLEMENTED;
   }
   Operation* const child;
+  const PointerMap* const pointer_map;
 };
 
 struct ConvertSliceOfBytesToString : public Operation
 {
-  ConvertSliceOfBytesToString (Operation* c) : child (c) { }
+  ConvertSliceOfBytesToString (Operation* c)
+    : child (c)
+    , pointer_map (runtime::pointer_map (&named_uint8))
+  { }
   Control
   execute (ExecutorBase& exec) const
   {
@@ -983,7 +1823,7 @@ struct ConvertSliceOfBytesToString : public Operation
     runtime::Slice in;
     exec.stack ().pop (in);
     runtime::String out;
-    void* o = exec.heap ()->allocate (in.length);
+    void* o = exec.heap ()->allocate_uninitialized (in.length, pointer_map);
     memcpy (o, in.ptr, in.length);
     out.ptr = o;
     out.length = in.length;
@@ -998,6 +1838,7 @@ struct ConvertSliceOfBytesToString : public Operation
     std::cout << ")";
   }
   Operation* const child;
+  const PointerMap* const pointer_map;
 };
 
 template<typename FromType, typename ToType>
@@ -1007,11 +1848,20 @@ struct Conversion : public Operation
   virtual Control execute (ExecutorBase& exec) const
   {
     child->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    child->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
     FromType x;
     exec.stack ().pop (x);
     ToType y = x;
     exec.stack ().push (y);
-    return Control_Continue;
   }
   virtual void dump () const
   {
@@ -1143,6 +1993,13 @@ Popn::execute (ExecutorBase& exec) const
   return r;
 }
 
+void
+Popn::compile (Compiler& compiler) const
+{
+  child->compile (compiler);
+  compiler.emit_size (Op_Popn, size);
+}
+
 Control PrintlnOp::execute (ExecutorBase& exec) const
 {
   ListOperation* lop = static_cast<ListOperation*> (args);
@@ -1312,17 +2169,44 @@ make_heap_link (Heap* heap,
   heap_link_t* hl = static_cast<heap_link_t*> (allocator->allocate (sizeof (heap_link_t)));
   // Set up the link.
   hl->heap = heap;
-  pthread_mutex_init (&hl->mutex, NULL);
   return hl;
 }
 
+const PointerMap* pointer_map (const type::Type* type)
+{
+  typedef std::map<const type::Type*, const PointerMap*> MapType;
+  static MapType maps;
+
+  MapType::const_iterator pos = maps.find (type);
+  if (pos != maps.end ())
+    {
+      return pos->second;
+    }
+
+  PointerMap* pm = new PointerMap (util::align_up (arch::size (type), arch::alignment (type)));
+  arch::pointer_offsets (type, 0, pm->offsets);
+  if (pm->offsets.size () * sizeof (void*) == pm->size)
+    {
+      // Scanning every word is exact.
+      delete pm;
+      pm = NULL;
+    }
+  maps[type] = pm;
+  return pm;
+}
+
+NewOp::NewOp (const type::Type* a_type)
+  : type (a_type)
+  , pointer_map (a_type->to_heap () == NULL ? runtime::pointer_map (a_type) : NULL)
+{ }
+
 Control NewOp::execute (ExecutorBase& exec) const
 {
   // Allocate a new instance of the type.
   const type::Heap* heap_type = type->to_heap ();
   if (heap_type == NULL)
     {
-      exec.stack ().push (exec.heap ()->allocate (arch::size (type)));
+      exec.stack ().push (exec.heap ()->allocate (arch::size (type), pointer_map));
     }
   else
     {
@@ -1340,6 +2224,19 @@ Control NewOp::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
+Control StackNewOp::execute (ExecutorBase& exec) const
+{
+  exec.stack ().clear (offset, size);
+  exec.stack ().push_address (offset);
+  return Control_Continue;
+}
+
+void StackNewOp::compile (Compiler& compiler) const
+{
+  compiler.emit_offset_size (Op_Clear, offset, size);
+  compiler.emit_offset (Op_Push_Address, offset);
+}
+
 Control MoveOp::execute (ExecutorBase& exec) const
 {
   arg->execute (exec);
@@ -1348,14 +2245,10 @@ Control MoveOp::execute (ExecutorBase& exec) const
   exec.stack ().pop (hl);
   if (hl != NULL)
     {
-      pthread_mutex_lock (&hl->mutex);
-      if (hl->heap != NULL && hl->change_count == 0)
+      // Break the link.
+      Heap* h = break_link (hl);
+      if (h != NULL)
         {
-          // Break the link.
-          Heap* h = hl->heap;
-          hl->heap = NULL;
-          pthread_mutex_unlock (&hl->mutex);
-
           // Remove from parent.
           h->remove_from_parent ();
           // Insert into the new parent.
@@ -1370,7 +2263,6 @@ Control MoveOp::execute (ExecutorBase& exec) const
         }
       else
         {
-          pthread_mutex_unlock (&hl->mutex);
           exec.stack ().push (NULL);
         }
     }
@@ -1391,14 +2283,10 @@ Control MergeOp::execute (ExecutorBase& exec) const
   exec.stack ().pop (hl);
   if (hl != NULL)
     {
-      pthread_mutex_lock (&hl->mutex);
-      if (hl->heap != NULL && hl->change_count == 0)
+      // Break the link.
+      Heap* h = break_link (hl);
+      if (h != NULL)
         {
-          // Break the link.
-          Heap* h = hl->heap;
-          hl->heap = NULL;
-          pthread_mutex_unlock (&hl->mutex);
-
           // Get the heap root.
           char* root = static_cast<char*> (h->root ());
 
@@ -1413,7 +2301,6 @@ Control MergeOp::execute (ExecutorBase& exec) const
         }
       else
         {
-          pthread_mutex_unlock (&hl->mutex);
           exec.stack ().push (NULL);
         }
     }
@@ -1425,16 +2312,30 @@ Control MergeOp::execute (ExecutorBase& exec) const
   return Control_Continue;
 }
 
-Control LenOp::execute (ExecutorBase& exec) const
+
+static void
+len (ExecutorBase& exec, const Operation*)
 {
-  arg->execute (exec);
   runtime::Slice slice;
   exec.stack ().pop (slice);
   long retval = slice.length;
   exec.stack ().push (retval);
+}
+
+Control LenOp::execute (ExecutorBase& exec) const
+{
+  arg->execute (exec);
+  len (exec, this);
   return Control_Continue;
 }
 
+void
+LenOp::compile (Compiler& compiler) const
+{
+  arg->compile (compiler);
+  compiler.emit_apply (len, this);
+}
+
 template <typename T>
 struct AppendOp : public Operation
 {
@@ -1442,6 +2343,7 @@ struct AppendOp : public Operation
             Operation* a_arg)
     : slice_type (a_slice_type)
     , arg (a_arg)
+    , pointer_map (runtime::pointer_map (a_slice_type->base_type))
   { }
 
   virtual Control execute (ExecutorBase& exec) const
@@ -1460,8 +2362,12 @@ struct AppendOp : public Operation
     if (new_length > slice.capacity)
       {
         const unsigned long new_capacity = 2 * new_length;
-        void* ptr = exec.heap ()->allocate (new_capacity * arch::unit_size (slice_type));
-        memcpy (ptr, slice.ptr, slice.length * arch::unit_size (slice_type));
+        const size_t old_size = slice.length * arch::unit_size (slice_type);
+        const size_t new_size = new_capacity * arch::unit_size (slice_type);
+        // Only the capacity past the copied elements needs clearing.
+        void* ptr = exec.heap ()->allocate_uninitialized (new_size, pointer_map);
+        memcpy (ptr, slice.ptr, old_size);
+        memset (static_cast<char*> (ptr) + old_size, 0, new_size - old_size);
         slice.ptr = ptr;
         slice.capacity = new_capacity;
       }
@@ -1477,6 +2383,7 @@ struct AppendOp : public Operation
   }
   const type::Slice* const slice_type;
   Operation* const arg;
+  const PointerMap* const pointer_map;
 };
 
 Operation* make_append (const type::Slice* slice_type, Operation* args)
@@ -1490,6 +2397,14 @@ Operation* make_append (const type::Slice* slice_type, Operation* args)
     }
 }
 
+CopyOp::CopyOp (const type::Type* a_type, Operation* a_arg)
+  : type (a_type)
+  , arg (a_arg)
+  , pointer_map (a_type->underlying_type ()->to_slice () != NULL ?
+                 runtime::pointer_map (a_type->underlying_type ()->to_slice ()->base_type) :
+                 runtime::pointer_map (&named_uint8))
+{ }
+
 Control CopyOp::execute (ExecutorBase& exec) const
 {
   arg->execute (exec);
@@ -1501,7 +2416,7 @@ Control CopyOp::execute (ExecutorBase& exec) const
       exec.stack ().pop (in);
       runtime::Slice out;
       size_t sz = arch::unit_size (slice_type) * in.length;
-      out.ptr = exec.heap ()->allocate (sz);
+      out.ptr = exec.heap ()->allocate_uninitialized (sz, pointer_map);
       memcpy (out.ptr, in.ptr, sz);
       out.length = in.length;
       out.capacity = in.length;
@@ -1514,7 +2429,7 @@ Control CopyOp::execute (ExecutorBase& exec) const
       runtime::String in;
       exec.stack ().pop (in);
       runtime::String out;
-      void* o = exec.heap ()->allocate (in.length);
+      void* o = exec.heap ()->allocate_uninitialized (in.length, pointer_map);
       memcpy (o, in.ptr, in.length);
       out.ptr = o;
       out.length = in.length;
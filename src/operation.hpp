@@ -1,11 +1,15 @@
 #ifndef RC_SRC_OPERATION_HPP
 #define RC_SRC_OPERATION_HPP
 
+#include <iosfwd>
+#include <typeinfo>
+
 #include "location.hpp"
 #include "executor_base.hpp"
 #include "type.hpp"
 #include "symbol.hpp"
 #include "expression_value.hpp"
+#include "bytecode.hpp"
 
 namespace runtime
 {
@@ -22,12 +26,28 @@ struct Operation
   virtual ~Operation() { }
   virtual Control execute (ExecutorBase& exec) const = 0;
   virtual void dump () const = 0;
+  // Emit bytecode for this operation.
+  // The default executes the operation tree.
+  virtual void compile (Compiler& compiler) const;
+  // Write C++ statements that do what the function this operation
+  // passes to Compiler::emit_apply does.  Returns false if native code
+  // must call the function instead, which is the default.
+  virtual bool emit_native (std::ostream& out) const;
 };
 
+// Write the C++ that applies op to operands of type popped from the
+// stack and pushes the result.  Return false if a type has no spelling
+// in native code.
+bool emit_native_unary (std::ostream& out, const char* op, const std::type_info& type, const std::type_info& result);
+bool emit_native_binary (std::ostream& out, const char* op, const std::type_info& type, const std::type_info& result);
+bool emit_native_binary_literal (std::ostream& out, const char* op, const std::type_info& type, const std::type_info& result, const void* value);
+bool emit_native_shift (std::ostream& out, const char* op, const std::type_info& type);
+
 struct Load : public Operation
 {
-  Load (const Operation* c, const type::Type* t) : child (c), type (t) { }
+  Load (const Operation* c, const type::Type* t) : child (c), type (t), size (arch::size (t)) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     std::cout << "Load(";
@@ -36,12 +56,18 @@ struct Load : public Operation
   }
   const Operation* const child;
   const type::Type* const type;
+  size_t const size;
 };
 
+// Return a Load specialized for the size of type.
+Operation* make_load (const Operation* child, const type::Type* type);
+
 struct IndexArray : public Operation
 {
-  IndexArray (const util::Location& l, Operation* b, Operation* i, const type::Array* t) : location (l), base (b), index (i), type (t) { }
+  IndexArray (const util::Location& l, Operation* b, Operation* i, const type::Array* t, bool c = true) : location (l), base (b), index (i), type (t), unit_size (arch::unit_size (t)), checked (c) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual bool emit_native (std::ostream& out) const;
   virtual void dump () const
   {
     std::cout << "IndexArray (";
@@ -54,12 +80,17 @@ struct IndexArray : public Operation
   Operation* const base;
   Operation* const index;
   const type::Array* type;
+  size_t const unit_size;
+  // False if the index is known to be in bounds.
+  bool const checked;
 };
 
 struct IndexSlice : public Operation
 {
-  IndexSlice (const util::Location& l, const Operation* b, const Operation* i, const type::Slice* t) : location (l), base (b), index (i), type (t) { }
+  IndexSlice (const util::Location& l, const Operation* b, const Operation* i, const type::Slice* t, bool c = true) : location (l), base (b), index (i), type (t), unit_size (arch::unit_size (t)), checked (c) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual bool emit_native (std::ostream& out) const;
   virtual void dump () const
   {
     std::cout << "IndexSlice(";
@@ -72,6 +103,9 @@ struct IndexSlice : public Operation
   const Operation* const base;
   const Operation* const index;
   const type::Slice* type;
+  size_t const unit_size;
+  // False if the index is known to be in bounds.
+  bool const checked;
 };
 
 struct SliceArray : public Operation
@@ -167,15 +201,27 @@ struct SliceSlice : public Operation
 Operation* MakeConvertToInt (const Operation* c, const type::Type* type);
 Operation* MakeConvertToUint (const Operation* c, const type::Type* type);
 
+struct LiteralBase : public Operation
+{
+  LiteralBase (const void* a, size_t s) : address (a), size (s) { }
+  // The bytes of the value.
+  const void* const address;
+  size_t const size;
+};
+
 template <typename T>
-struct Literal : public Operation
+struct Literal : public LiteralBase
 {
-  Literal (T v) : value (v) { }
+  Literal (T v) : LiteralBase (&value, sizeof (T)), value (v) { }
   virtual Control execute (ExecutorBase& exec) const
   {
     exec.stack ().push (value);
     return Control_Continue;
   }
+  virtual void compile (Compiler& compiler) const
+  {
+    compiler.emit_data (&value, sizeof (T));
+  }
   virtual void dump () const
   {
     std::cout << "Literal value=" << value << '\n';
@@ -191,11 +237,14 @@ make_literal (T v)
 }
 
 Operation* make_literal (const type::Type* type, const semantic::Value& value);
+// True if make_literal supports type.
+bool is_literal_type (const type::Type* type);
 
 struct LogicOr : public Operation
 {
   LogicOr (const Operation* l, const Operation* r) : left (l), right (r) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -208,6 +257,7 @@ struct LogicAnd : public Operation
 {
   LogicAnd (const Operation* l, const Operation* r) : left (l), right (r) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -231,6 +281,7 @@ struct ListOperation : public Operation
 
 
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     std::cout << "List(";
@@ -251,6 +302,7 @@ struct FunctionCall : public Operation
 {
   FunctionCall (const decl::Callable* c, Operation* o) : callable (c), arguments (o) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     std::cout << "Function(";
@@ -265,6 +317,7 @@ struct MethodCall : public Operation
 {
   MethodCall (const decl::Callable* c, Operation* r, Operation* o) : callable (c), receiver (r), arguments (o) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     std::cout << "Method(";
@@ -278,6 +331,37 @@ struct MethodCall : public Operation
   Operation* const arguments;
 };
 
+// Call whose body has been generated into the caller's frame.
+// The arguments are copied to the inlined frame at frame_offset which has the
+// same layout as the callee's frame.  No frame is set up or torn down.
+struct InlineCall : public Operation
+{
+  InlineCall (const decl::Callable* c, Operation* r, Operation* a, Operation* b, ptrdiff_t o);
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual void dump () const
+  {
+    std::cout << "Inline(";
+    if (receiver)
+      {
+        receiver->dump ();
+        std::cout << ", ";
+      }
+    arguments->dump ();
+    std::cout << ", ";
+    body->dump ();
+    std::cout << ")";
+  }
+  const decl::Callable* const callable;
+  Operation* const receiver;
+  Operation* const arguments;
+  Operation* const body;
+  // Offset of the return parameter which is the start of the inlined frame.
+  ptrdiff_t const frame_offset;
+  size_t const return_size;
+  size_t const arguments_size;
+};
+
 struct DynamicPullPortCall : public Operation
 {
   DynamicPullPortCall (const type::PullPort* t, Operation* f, Operation* a) : type (t), func (f), arguments (a) { }
@@ -320,6 +404,7 @@ struct Clear : public Operation
 {
   Clear (ptrdiff_t o, size_t s) : offset (o), size (s) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -339,6 +424,7 @@ struct Assign : public Operation
     assert (right != NULL);
   }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -348,12 +434,24 @@ struct Assign : public Operation
   size_t const size;
 };
 
+// Return an Assign specialized for the size of type.
+Operation* make_assign (Operation* left, Operation* right, const type::Type* type);
+
+// Assign followed by the write barrier for a generational heap.
+struct BarrierAssign : public Assign
+{
+  BarrierAssign (Operation* l, Operation* r, const type::Type* t) : Assign (l, r, t) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+};
+
 Operation* make_add_assign (Operation* l, Operation* r, const type::Type* t);
 
 struct Reference : public Operation
 {
   Reference (ptrdiff_t o) : offset (o) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     std::cout << "Reference offset=" << offset << '\n';
@@ -365,6 +463,7 @@ struct Select : public Operation
 {
   Select (Operation* b, ptrdiff_t o) : base (b), offset (o) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     std::cout << "Select (";
@@ -377,12 +476,13 @@ struct Select : public Operation
 
 struct Return : public Operation
 {
-  Return (Operation* c, const decl::Parameter* r)
+  Return (Operation* c, ptrdiff_t o, size_t s)
     : child (c)
-    , return_offset (r->offset ())
-    , return_size (arch::size (r->type))
+    , return_offset (o)
+    , return_size (s)
   { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -396,6 +496,7 @@ struct If : public Operation
 {
   If (Operation* c, Operation* t, Operation* f) : condition (c), true_branch (t), false_branch (f) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -409,6 +510,7 @@ struct While : public Operation
 {
   While (Operation* c, Operation* b) : condition (c), body (b) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -419,7 +521,7 @@ struct While : public Operation
 
 struct ForIota : public Operation
 {
-  ForIota (const decl::Variable* symbol, long l, Operation* b) : offset (symbol->offset ()), limit (l), body (b) { }
+  ForIota (ptrdiff_t o, long l, Operation* b) : offset (o), limit (l), body (b) { }
   virtual Control execute (ExecutorBase& exec) const;
   virtual void dump () const
   {
@@ -436,11 +538,24 @@ struct Unary : public Operation
   Unary (Operation* c) : child (c) { }
   virtual Control execute (ExecutorBase& exec) const
   {
-    typename T::ValueType x;
     child->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    child->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
+    typename T::ValueType x;
     exec.stack ().pop (x);
     exec.stack ().push (T () (x));
-    return Control_Continue;
+  }
+  virtual bool emit_native (std::ostream& out) const
+  {
+    return emit_native_unary (out, T::native_operator (), typeid (typename T::ValueType), typeid (T ().operator() (typename T::ValueType ())));
   }
   virtual void dump () const
   {
@@ -462,20 +577,87 @@ Operation* make_unary (const type::Type* type, Operation* child)
     }
 }
 
+struct BinaryBase : public Operation
+{
+  BinaryBase (Operation* l, Operation* r) : left (l), right (r) { }
+  // Return an equivalent operation with a literal right operand or NULL.
+  virtual Operation* fuse_literal () const = 0;
+  Operation* const left;
+  Operation* const right;
+};
+
 template <typename V, typename T>
-struct Binary : public Operation
+struct BinaryLiteral : public Operation
 {
-  Binary (Operation* l, Operation* r) : left (l), right (r) { }
+  BinaryLiteral (Operation* l, V v) : left (l), value (v) { }
   virtual Control execute (ExecutorBase& exec) const
   {
-    V x;
-    V y;
     left->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    left->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation* operation)
+  {
+    V x;
     exec.stack ().pop (x);
+    exec.stack ().push (T () (x, static_cast<const BinaryLiteral*> (operation)->value));
+  }
+  virtual bool emit_native (std::ostream& out) const
+  {
+    return emit_native_binary_literal (out, T::native_operator (), typeid (V), typeid (T ().operator() (V (), V ())), &value);
+  }
+  virtual void dump () const
+  {
+    std::cout << "BinaryLiteral(";
+    left->dump ();
+    std::cout << ")";
+  }
+  Operation* const left;
+  V const value;
+};
+
+template <typename V, typename T>
+struct Binary : public BinaryBase
+{
+  Binary (Operation* l, Operation* r) : BinaryBase (l, r) { }
+  virtual Control execute (ExecutorBase& exec) const
+  {
+    left->execute (exec);
     right->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    left->compile (compiler);
+    right->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
+    V x;
+    V y;
     exec.stack ().pop (y);
+    exec.stack ().pop (x);
     exec.stack ().push (T () (x, y));
-    return Control_Continue;
+  }
+  virtual bool emit_native (std::ostream& out) const
+  {
+    return emit_native_binary (out, T::native_operator (), typeid (V), typeid (T ().operator() (V (), V ())));
+  }
+  virtual Operation* fuse_literal () const
+  {
+    const Literal<V>* r = dynamic_cast<const Literal<V>*> (right);
+    if (r == NULL)
+      {
+        return NULL;
+      }
+    return new BinaryLiteral<V, T> (left, r->value);
   }
   virtual void dump () const
   {
@@ -485,8 +667,6 @@ struct Binary : public Operation
     right->dump ();
     std::cout << ")";
   }
-  Operation* const left;
-  Operation* const right;
 };
 
 template <typename V, typename T>
@@ -495,14 +675,28 @@ struct Shift : public Operation
   Shift (Operation* l, Operation* r) : left (l), right (r) { }
   virtual Control execute (ExecutorBase& exec) const
   {
-    V x;
-    unsigned long y;
     left->execute (exec);
-    exec.stack ().pop (x);
     right->execute (exec);
+    apply (exec, this);
+    return Control_Continue;
+  }
+  virtual void compile (Compiler& compiler) const
+  {
+    left->compile (compiler);
+    right->compile (compiler);
+    compiler.emit_apply (apply, this);
+  }
+  static void apply (ExecutorBase& exec, const Operation*)
+  {
+    V x;
+    unsigned long y;
     exec.stack ().pop (y);
+    exec.stack ().pop (x);
     exec.stack ().push (T () (x, y));
-    return Control_Continue;
+  }
+  virtual bool emit_native (std::ostream& out) const
+  {
+    return emit_native_shift (out, T::native_operator (), typeid (V));
   }
   virtual void dump () const
   {
@@ -723,6 +917,7 @@ struct Noop : public Operation
   {
     return Control_Continue;
   }
+  virtual void compile (Compiler& compiler) const { }
   virtual void dump () const
   {
     std::cout << "Noop()";
@@ -731,10 +926,100 @@ struct Noop : public Operation
 
 Operation* make_conversion (Operation* c, const type::Type* from, const type::Type* to);
 
+// Fused operations.
+// These replace common subtrees to reduce the number of dispatches.
+
+// Load (Reference).
+struct LoadLocal : public Operation
+{
+  LoadLocal (ptrdiff_t o, size_t s) : offset (o), size (s) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual void dump () const
+  {
+    std::cout << "LoadLocal offset=" << offset << " size=" << size << '\n';
+  }
+  ptrdiff_t const offset;
+  size_t const size;
+};
+
+Operation* make_load_local (ptrdiff_t offset, size_t size);
+
+// Select (Load (Reference)).
+struct FieldAddress : public Operation
+{
+  FieldAddress (ptrdiff_t o, ptrdiff_t f) : offset (o), field (f) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual void dump () const
+  {
+    std::cout << "FieldAddress offset=" << offset << " field=" << field << '\n';
+  }
+  ptrdiff_t const offset;
+  ptrdiff_t const field;
+};
+
+// Load (Select (Load (Reference))).
+struct LoadField : public Operation
+{
+  LoadField (ptrdiff_t o, ptrdiff_t f, size_t s) : offset (o), field (f), size (s) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual void dump () const
+  {
+    std::cout << "LoadField offset=" << offset << " field=" << field << " size=" << size << '\n';
+  }
+  ptrdiff_t const offset;
+  ptrdiff_t const field;
+  size_t const size;
+};
+
+Operation* make_load_field (ptrdiff_t offset, ptrdiff_t field, size_t size);
+
+// Assign (Reference, ...).
+struct AssignLocal : public Operation
+{
+  AssignLocal (ptrdiff_t o, Operation* r, size_t s) : offset (o), right (r), size (s) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual void dump () const
+  {
+    UNIMPLEMENTED;
+  }
+  ptrdiff_t const offset;
+  Operation* const right;
+  size_t const size;
+};
+
+Operation* make_assign_local (ptrdiff_t offset, Operation* right, size_t size);
+
+// Assign (..., Literal).
+struct AssignLiteral : public Operation
+{
+  AssignLiteral (Operation* l, const LiteralBase* r) : left (l), right (r) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual void dump () const
+  {
+    UNIMPLEMENTED;
+  }
+  Operation* const left;
+  const LiteralBase* const right;
+};
+
+// Increment (Reference) and Increment (FieldAddress) and likewise for Decrement.
+// The pointer to the value is base_pointer + offset for a local and
+// the pointer at base_pointer + offset plus field for a field.
+Operation* make_increment_local (ptrdiff_t offset, const type::Type* type);
+Operation* make_increment_field (ptrdiff_t offset, ptrdiff_t field, const type::Type* type);
+Operation* make_decrement_local (ptrdiff_t offset, const type::Type* type);
+Operation* make_decrement_field (ptrdiff_t offset, ptrdiff_t field, const type::Type* type);
+
 struct Popn : public Operation
 {
   Popn (Operation* c, size_t s) : child (c), size (s) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -759,11 +1044,13 @@ struct PrintlnOp : public Operation
   Operation* const args;
 };
 
+// Return the pointer map for objects of type or NULL if every word of
+// the type may be a pointer.  Pointer maps are shared and never freed.
+const PointerMap* pointer_map (const type::Type* type);
+
 struct NewOp : public Operation
 {
-  NewOp (const type::Type* a_type)
-    : type (a_type)
-  { }
+  NewOp (const type::Type* a_type);
   virtual Control execute (ExecutorBase& exec) const;
   virtual void dump () const
   {
@@ -771,6 +1058,22 @@ struct NewOp : public Operation
   }
 
   const type::Type* const type;
+  const PointerMap* const pointer_map;
+};
+
+// Allocate a cleared object in the frame at offset and push its address.
+// Used for the results of new that never leave the frame.
+struct StackNewOp : public Operation
+{
+  StackNewOp (ptrdiff_t o, size_t s) : offset (o), size (s) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
+  virtual void dump () const
+  {
+    std::cout << "StackNewOp offset=" << offset << " size=" << size << '\n';
+  }
+  ptrdiff_t const offset;
+  size_t const size;
 };
 
 struct MoveOp : public Operation
@@ -799,6 +1102,7 @@ struct LenOp : public Operation
 {
   LenOp (Operation* a_arg) : arg (a_arg) { }
   virtual Control execute (ExecutorBase& exec) const;
+  virtual void compile (Compiler& compiler) const;
   virtual void dump () const
   {
     UNIMPLEMENTED;
@@ -810,9 +1114,7 @@ Operation* make_append (const type::Slice* slice_type, Operation* args);
 
 struct CopyOp : public Operation
 {
-  CopyOp (const type::Type* a_type, Operation* a_arg)
-    : type (a_type)
-    , arg (a_arg) { }
+  CopyOp (const type::Type* a_type, Operation* a_arg);
   virtual Control execute (ExecutorBase& exec) const;
   virtual void dump () const
   {
@@ -820,6 +1122,31 @@ struct CopyOp : public Operation
   }
   const type::Type* const type;
   Operation* const arg;
+  const PointerMap* const pointer_map;
+};
+
+// A linear translation of an operation tree run by a dispatch loop.
+struct Bytecode : public Operation
+{
+  Bytecode (const Operation* root);
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void dump () const;
+  const Operation* const root;
+  Compiler::CodeType const code;
+};
+
+// Function in a shared object generated by NativeModule.
+typedef Control (*NativeFunction) (ExecutorBase& exec);
+
+// An operation tree translated to C++ and compiled ahead of time.
+// The tree is executed until the shared object is loaded.
+struct Native : public Operation
+{
+  Native (const Operation* r) : root (r), function (NULL) { }
+  virtual Control execute (ExecutorBase& exec) const;
+  virtual void dump () const;
+  const Operation* const root;
+  NativeFunction function;
 };
 
 }
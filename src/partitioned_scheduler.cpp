@@ -70,13 +70,20 @@ partitioned_scheduler_t::init (composition::Composer& instance_table,
       for (composition::ActionsType::const_iterator action_pos = instance->actions.begin (),
            action_limit = instance->actions.end ();
            action_pos != action_limit;
-           ++action_pos)
+           action_pos += (*action_pos)->batch_size)
         {
           composition::Action* action = *action_pos;
           switch (action->action->precondition_kind)
             {
             case Action::Dynamic:
-              initialize_task (new action_task_t (action), thread_count);
+              if (action->batch_size == 1)
+                {
+                  initialize_task (new action_task_t (action), thread_count);
+                }
+              else
+                {
+                  initialize_task (new batch_task_t (&*action_pos, action->batch_size), thread_count);
+                }
               break;
             case Action::Static_True:
               initialize_task (new always_task_t (action), thread_count);
@@ -87,7 +94,13 @@ partitioned_scheduler_t::init (composition::Composer& instance_table,
             }
         }
 
-      initialize_task (new gc_task_t (component_to_info (instance->component)), thread_count);
+      // Collections are queued when an allocation crosses a threshold.
+      info_t* info = static_cast<info_t*> (component_to_info (instance->component));
+      info->gc_task = new gc_task_t (info);
+      if (info->heap ()->policy ().compact)
+        {
+          executors_[rand () % thread_count]->add_compaction (info);
+        }
     }
 }
 
@@ -289,6 +302,16 @@ partitioned_scheduler_t::executor_t::run_i ()
                   state = WAIT2;
                   send (Message::make_start_waiting2 (id_));
                 }
+              else if (compact_heaps (generation))
+                {
+                  // The program is waiting for input so compact
+                  // before polling.
+                }
+              else if (compactions_ != 0)
+                {
+                  // A compaction is waiting for a lock.
+                  sleep ();
+                }
               else
                 {
                   state = POLL;
@@ -428,6 +451,29 @@ partitioned_scheduler_t::executor_t::poll ()
   return false;
 }
 
+bool
+partitioned_scheduler_t::executor_t::compact_heaps (size_t generation)
+{
+  bool retval = false;
+  for (std::vector<info_t*>::const_iterator pos = compact_infos_.begin (),
+       limit = compact_infos_.end ();
+       pos != limit;
+       ++pos)
+    {
+      info_t* info = *pos;
+      if (info->heap ()->wants_compaction () &&
+          __sync_bool_compare_and_swap (&info->gc_queued, false, true))
+        {
+          info->compact = true;
+          info->gc_task->executor = this;
+          ++compactions_;
+          info->gc_task->execute (generation);
+          retval = true;
+        }
+    }
+  return retval;
+}
+
 partitioned_scheduler_t::ExecutionResult
 partitioned_scheduler_t::task_t::execute (size_t generation)
 {
@@ -437,6 +483,41 @@ partitioned_scheduler_t::task_t::execute (size_t generation)
   return resume (generation);
 }
 
+void
+partitioned_scheduler_t::task_t::exclusive (bool flag)
+{
+  for (composition::InstanceSet::const_iterator pos = set ().begin (), limit = set ().end ();
+       pos != limit;
+       ++pos)
+    {
+      if (pos->second == AccessWrite)
+        {
+          info_t* info = *reinterpret_cast<info_t**> (pos->first->component);
+          info->heap ()->exclusive (flag);
+        }
+    }
+}
+
+void
+partitioned_scheduler_t::task_t::queue_collections ()
+{
+  for (composition::InstanceSet::const_iterator pos = set ().begin (), limit = set ().end ();
+       pos != limit;
+       ++pos)
+    {
+      if (pos->second == AccessWrite)
+        {
+          info_t* info = *reinterpret_cast<info_t**> (pos->first->component);
+          if (info->heap ()->wants_collection () &&
+              __sync_bool_compare_and_swap (&info->gc_queued, false, true))
+            {
+              info->gc_task->executor = executor;
+              info->gc_task->to_idle_list ();
+            }
+        }
+    }
+}
+
 partitioned_scheduler_t::ExecutionResult
 partitioned_scheduler_t::task_t::resume (size_t generation)
 {
@@ -469,9 +550,15 @@ partitioned_scheduler_t::task_t::resume (size_t generation)
       last_execution_kind_ = HIT;
     }
 
-  // Got all the locks.  Execute.
+  // Got all the locks.  The heaps of the written instances are
+  // exclusive.
+  exclusive (true);
+
+  // Execute.
   ExecutionResult er;
   bool hit = execute_i ();
+  exclusive (false);
+  queue_collections ();
   switch (last_execution_kind_)
     {
     case HIT:
@@ -518,10 +605,27 @@ partitioned_scheduler_t::task_t::resume (size_t generation)
         }
     }
 
-  // Put back on the ready list.
+  // Put back on the idle list.
+  if (transient ())
+    {
+      retire ();
+      return NONE;
+    }
   to_idle_list ();
 
   return er;
 }
 
+void
+partitioned_scheduler_t::gc_task_t::retire ()
+{
+  info_t* i = static_cast<info_t*> (info);
+  if (i->compact)
+    {
+      i->compact = false;
+      executor->compaction_done ();
+    }
+  __atomic_store_n (&i->gc_queued, false, __ATOMIC_RELEASE);
+}
+
 }
@@ -42,6 +42,9 @@ private:
   public:
     info_t (composition::Instance* instance)
       : ComponentInfoBase (instance)
+      , gc_task (NULL)
+      , gc_queued (false)
+      , compact (false)
       , lock_ (0)
       , count_ (0)
       , head_ (NULL)
@@ -116,6 +119,15 @@ private:
       process_list ();
     }
 
+    // Collects the heap.  It is only queued when the heap wants a
+    // collection.
+    task_t* gc_task;
+    // The collection task is queued or running.  Set with a
+    // compare-and-swap by the executor that queues the task.
+    bool gc_queued;
+    // The collection task compacts the heap.
+    bool compact;
+
   private:
     void
     process_list ()
@@ -200,6 +212,19 @@ private:
 
     ExecutionResult execute (size_t generation);
     ExecutionResult resume (size_t generation);
+    // Mark the heaps of the instances written by the task as exclusive.
+    void exclusive (bool flag);
+    // Queue the collection of the heaps written by the task that
+    // allocated past their thresholds.
+    void queue_collections ();
+    // A transient task is not kept on the idle list or counted when
+    // detecting termination.
+    virtual bool transient () const
+    {
+      return false;
+    }
+    // Called when a transient task has released its locks.
+    virtual void retire () { }
     void to_ready_list ()
     {
       executor->to_ready_list (this);
@@ -241,6 +266,26 @@ private:
     }
   };
 
+  struct batch_task_t : public task_t
+  {
+    batch_task_t (const composition::Action* const* a, size_t c)
+      : actions (a)
+      , count (c)
+    { }
+
+    const composition::Action* const* const actions;
+    size_t const count;
+
+    const composition::InstanceSet& set () const
+    {
+      return actions[0]->instance_set ();
+    }
+    virtual bool execute_i () const
+    {
+      return executor->execute (actions, count);
+    }
+  };
+
   struct always_task_t : public task_t
   {
     always_task_t (const composition::Action* a)
@@ -277,8 +322,13 @@ private:
     }
     virtual bool execute_i () const
     {
-      return executor->collect_garbage (info);
+      return executor->collect_garbage (info, static_cast<info_t*> (info)->compact);
+    }
+    virtual bool transient () const
+    {
+      return true;
     }
+    virtual void retire ();
   };
 
   class executor_t : public ExecutorBase
@@ -301,6 +351,7 @@ private:
       , task_count_ (0)
       , track_file_descriptors_ (false)
       , using_eventfd_ (false)
+      , compactions_ (0)
     {
       pthread_mutex_init (&mutex_, NULL);
       pthread_cond_init (&cond_, NULL);
@@ -356,6 +407,17 @@ private:
       ++task_count_;
     }
 
+    // Compact the heap of the instance when the program is quiescent.
+    void add_compaction (info_t* info)
+    {
+      compact_infos_.push_back (info);
+    }
+
+    void compaction_done ()
+    {
+      --compactions_;
+    }
+
     virtual void
     checked_for_readability (FileDescriptor* fd)
     {
@@ -518,6 +580,9 @@ private:
     }
 
     bool poll ();
+    // Start compacting the heaps that want it.  Return true if a
+    // compaction started.
+    bool compact_heaps (size_t generation);
 
     partitioned_scheduler_t& scheduler_;
     const size_t id_;
@@ -537,6 +602,9 @@ private:
     typedef std::map<FileDescriptor*, short> FileDescriptorMap;
     FileDescriptorMap file_descriptor_map_;
     bool using_eventfd_;
+    std::vector<info_t*> compact_infos_;
+    // Number of compactions started and not finished.
+    size_t compactions_;
   };
 
   void
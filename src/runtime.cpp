@@ -1,5 +1,10 @@
 #include "runtime.hpp"
 
+#include <error.h>
+#include <errno.h>
+
+#include <sstream>
+
 #include "node.hpp"
 #include "node_visitor.hpp"
 #include "callable.hpp"
@@ -36,8 +41,7 @@ allocate_instances (composition::Composer& instance_table)
         {
           const type::Type* type = instance->type;
           size_t size = arch::size (type);
-          ptr = static_cast<component_t*> (malloc (size));
-          memset (ptr, 0, size);
+          ptr = static_cast<component_t*> (calloc (1, size));
         }
       else
         {
@@ -47,15 +51,32 @@ allocate_instances (composition::Composer& instance_table)
     }
 }
 
-static void
-bind (PushPort** output_port, component_t* input_instance, const decl::Reaction* reaction, long parameter)
+static PushPort*
+make_push_port_table (const composition::ReactionsType& reactions)
 {
-  PushPort* port = new PushPort;
-  port->instance = input_instance;
-  port->reaction = reaction;
-  port->parameter = parameter;
-  port->next = *output_port;
-  *output_port = port;
+  void* ptr;
+  if (posix_memalign (&ptr, 64, (reactions.size () + 1) * sizeof (PushPort)) != 0)
+    {
+      error (EXIT_FAILURE, errno, "Could not allocate push port");
+    }
+  PushPort* table = static_cast<PushPort*> (ptr);
+  // Reactions are called in reverse order of binding.
+  PushPort* port = table;
+  for (composition::ReactionsType::const_reverse_iterator pos = reactions.rbegin (),
+       limit = reactions.rend ();
+       pos != limit;
+       ++pos, ++port)
+    {
+      const composition::Reaction* r = *pos;
+      port->instance = r->instance->component;
+      port->reaction = r->reaction;
+      port->composition_reaction = r;
+      port->parameter = r->iota;
+      port->locals_size = r->reaction->memory_model.locals_size_on_stack ();
+      port->has_parameter = r->reaction->dimension () != -1;
+    }
+  memset (port, 0, sizeof (PushPort));
+  return table;
 }
 
 void
@@ -70,16 +91,9 @@ create_bindings (composition::Composer& instance_table)
       composition::Instance* output_instance = pp->instance;
       size_t output_port = pp->address - output_instance->address;
 
-      for (composition::ReactionsType::const_iterator reaction_pos = pp->reactions.begin (),
-           reaction_limit = pp->reactions.end ();
-           reaction_pos != reaction_limit;
-           ++reaction_pos)
+      if (!pp->reactions.empty ())
         {
-          composition::Reaction* r = *reaction_pos;
-          bind (reinterpret_cast<PushPort**> (reinterpret_cast<char*> (output_instance->component) + output_port),
-                r->instance->component,
-                r->reaction,
-                r->iota);
+          *reinterpret_cast<PushPort**> (reinterpret_cast<char*> (output_instance->component) + output_port) = make_push_port_table (pp->reactions);
         }
     }
 
@@ -617,7 +631,8 @@ enabled (ExecutorBase& exec,
   exec.stack ().push_pointer (instance);
   // Push an instruction pointer.
   exec.stack ().push_pointer (NULL);
-  exec.stack ().setup (0 /* No locals. */);
+  // Inlined calls keep their frames in the locals of the action.
+  exec.stack ().setup (action->memory_model.locals_size_on_stack ());
   action->actiondecl->precondition->operation->execute (exec);
   bool retval;
   exec.stack ().pop (retval);
@@ -636,6 +651,50 @@ enabled (ExecutorBase& exec,
   return retval;
 }
 
+void
+enabled (ExecutorBase& exec,
+         component_t* instance,
+         const decl::Action* action,
+         long iota,
+         size_t count,
+         char* enabled)
+{
+  assert (exec.stack ().empty ());
+  assert (action->dimension () != -1);
+
+  // Push iota.  It is overwritten for each evaluation.
+  char* iota_ptr = exec.stack ().top ();
+  exec.stack ().push<unsigned long> (iota);
+  // Push receiver.
+  exec.stack ().push_pointer (instance);
+  // Push an instruction pointer.
+  exec.stack ().push_pointer (NULL);
+  // Inlined calls keep their frames in the locals of the action.
+  exec.stack ().setup (action->memory_model.locals_size_on_stack ());
+  const Operation* precondition = action->actiondecl->precondition->operation;
+  for (size_t idx = 0; idx != count; ++idx)
+    {
+      if (enabled[idx])
+        {
+          unsigned long x = iota + idx;
+          std::memcpy (iota_ptr, &x, sizeof (x));
+          precondition->execute (exec);
+          bool retval;
+          exec.stack ().pop (retval);
+          enabled[idx] = retval;
+        }
+    }
+  exec.stack ().teardown ();
+  // Pop the instruction pointer.
+  exec.stack ().pop_pointer ();
+  // Pop this.
+  exec.stack ().pop_pointer ();
+  // Pop iota.
+  unsigned long x;
+  exec.stack ().pop (x);
+  assert (exec.stack ().empty ());
+}
+
 static void
 execute (ExecutorBase& exec,
          const decl::Action* action,
@@ -701,6 +760,51 @@ void execute_no_check (ExecutorBase& exec, component_t* instance, const decl::Ac
   assert (exec.stack ().empty ());
 }
 
+static void
+print_heap_stats (FILE* profile_out, const char* kind, const std::string& name, size_t count, const HeapStats& s)
+{
+  fprintf (profile_out, "%s %s %zd %zd %zd %zd %zd %zd %zd %.3f %zd %lu.%.09lu %lu.%.09lu %zd\n",
+           kind, name.c_str (), count, s.heaps, s.allocated_bytes, s.live_bytes, s.used_bytes, s.blocks, s.block_bytes, s.fragmentation (),
+           s.collections, s.pause_ns / 1000000000, s.pause_ns % 1000000000, s.max_pause_ns / 1000000000, s.max_pause_ns % 1000000000,
+           s.scanned_objects);
+}
+
+void
+print_heap_profile (FILE* profile_out, composition::Composer& instance_table)
+{
+  typedef std::map<std::string, std::pair<size_t, HeapStats> > TypeStats;
+  TypeStats type_stats;
+
+  const char* columns = "count heaps allocated live used blocks block_bytes fragmentation collections pause max_pause scanned";
+  fprintf (profile_out, "BEGIN heap instance %s\n", columns);
+  for (composition::Composer::InstancesType::const_iterator pos = instance_table.instances_begin (),
+       limit = instance_table.instances_end ();
+       pos != limit;
+       ++pos)
+    {
+      composition::Instance* instance = pos->second;
+      HeapStats s;
+      component_to_info (instance->component)->heap ()->stats (&s);
+      print_heap_stats (profile_out, "HEAP", instance->name, 1, s);
+
+      std::stringstream type_name;
+      type_name << *instance->type;
+      std::pair<size_t, HeapStats>& t = type_stats[type_name.str ()];
+      ++t.first;
+      t.second.add (s);
+    }
+  fprintf (profile_out, "END heap\n");
+
+  fprintf (profile_out, "BEGIN heap_summary type %s\n", columns);
+  for (TypeStats::const_iterator pos = type_stats.begin (), limit = type_stats.end ();
+       pos != limit;
+       ++pos)
+    {
+      print_heap_stats (profile_out, "HEAP_TYPE", pos->first, pos->second.first, pos->second.second);
+    }
+  fprintf (profile_out, "END heap_summary\n");
+}
+
 }
 
 // void
@@ -1,6 +1,8 @@
 #ifndef RC_SRC_RUNTIME_HPP
 #define RC_SRC_RUNTIME_HPP
 
+#include <cstdio>
+
 #include "types.hpp"
 #include "runtime_types.hpp"
 
@@ -15,6 +17,11 @@ create_bindings (composition::Composer& instance_table);
 void
 initialize (ExecutorBase& exec, ComponentInfoBase* info);
 
+// Write the heap counters of every instance and a summary by
+// component type.  The instances must not be running.
+void
+print_heap_profile (FILE* profile_out, composition::Composer& instance_table);
+
 // Returns true if the action is enabled.
 bool
 enabled (ExecutorBase& exec,
@@ -22,6 +29,17 @@ enabled (ExecutorBase& exec,
          const decl::Action* action,
          long iota);
 
+// Evaluate the precondition of a dimensioned action for iota values
+// iota to iota + count - 1 in one frame.  Only iota + i with enabled[i]
+// set is evaluated and enabled[i] is replaced by the result.
+void
+enabled (ExecutorBase& exec,
+         component_t* instance,
+         const decl::Action* action,
+         long iota,
+         size_t count,
+         char* enabled);
+
 // Execute the action without checking the precondition.
 void
 execute_no_check (ExecutorBase& exec,
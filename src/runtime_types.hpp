@@ -89,12 +89,17 @@ private:
 // A cmponent_t* contains the address of a component instance.
 struct component_t;
 
+// A push port refers to a contiguous, cache-aligned table of the
+// reactions bound to it.  The table ends with an entry whose instance is
+// NULL.
 struct PushPort
 {
   component_t* instance;
   const decl::Reaction* reaction;
+  const composition::Reaction* composition_reaction;
   long parameter;
-  PushPort* next;
+  size_t locals_size;
+  bool has_parameter;
 };
 
 struct PullPort
@@ -24,6 +24,10 @@ struct Multiplier
   {
     return x * y;
   }
+  static const char* native_operator ()
+  {
+    return "*";
+  }
 };
 
 struct Divider
@@ -33,6 +37,10 @@ struct Divider
   {
     return x / y;
   }
+  static const char* native_operator ()
+  {
+    return "/";
+  }
 };
 
 struct Modulizer
@@ -42,6 +50,10 @@ struct Modulizer
   {
     return x % y;
   }
+  static const char* native_operator ()
+  {
+    return "%";
+  }
 };
 
 struct LeftShifter
@@ -51,6 +63,10 @@ struct LeftShifter
   {
     return x << y;
   }
+  static const char* native_operator ()
+  {
+    return "<<";
+  }
 
   static runtime::Operation*
   generate_code (const ExpressionValue& result,
@@ -65,6 +81,10 @@ struct RightShifter
   {
     return x >> y;
   }
+  static const char* native_operator ()
+  {
+    return ">>";
+  }
 
   static runtime::Operation*
   generate_code (const ExpressionValue& result,
@@ -79,6 +99,10 @@ struct BitAnder
   {
     return x & y;
   }
+  static const char* native_operator ()
+  {
+    return "&";
+  }
 };
 
 struct BitAndNotter
@@ -88,6 +112,10 @@ struct BitAndNotter
   {
     return x & (~y);
   }
+  static const char* native_operator ()
+  {
+    return "& ~";
+  }
 };
 
 struct Adder
@@ -97,6 +125,10 @@ struct Adder
   {
     return x + y;
   }
+  static const char* native_operator ()
+  {
+    return "+";
+  }
 };
 
 struct Subtracter
@@ -106,6 +138,10 @@ struct Subtracter
   {
     return x - y;
   }
+  static const char* native_operator ()
+  {
+    return "-";
+  }
 };
 
 struct BitOrer
@@ -115,6 +151,10 @@ struct BitOrer
   {
     return x | y;
   }
+  static const char* native_operator ()
+  {
+    return "|";
+  }
 };
 
 struct BitXorer
@@ -124,6 +164,10 @@ struct BitXorer
   {
     return x ^ y;
   }
+  static const char* native_operator ()
+  {
+    return "^";
+  }
 };
 
 struct Equalizer
@@ -133,6 +177,10 @@ struct Equalizer
   {
     return x == y;
   }
+  static const char* native_operator ()
+  {
+    return "==";
+  }
 };
 
 struct NotEqualizer
@@ -142,6 +190,10 @@ struct NotEqualizer
   {
     return x != y;
   }
+  static const char* native_operator ()
+  {
+    return "!=";
+  }
 };
 
 struct LessThaner
@@ -151,6 +203,10 @@ struct LessThaner
   {
     return x < y;
   }
+  static const char* native_operator ()
+  {
+    return "<";
+  }
 };
 
 struct LessEqualizer
@@ -160,6 +216,10 @@ struct LessEqualizer
   {
     return x <= y;
   }
+  static const char* native_operator ()
+  {
+    return "<=";
+  }
 };
 
 struct MoreThaner
@@ -169,6 +229,10 @@ struct MoreThaner
   {
     return x > y;
   }
+  static const char* native_operator ()
+  {
+    return ">";
+  }
 };
 
 struct MoreEqualizer
@@ -178,6 +242,10 @@ struct MoreEqualizer
   {
     return x >= y;
   }
+  static const char* native_operator ()
+  {
+    return ">=";
+  }
 };
 
 template <typename T>
@@ -188,6 +256,10 @@ struct LogicNotter
   {
     return !x;
   }
+  static const char* native_operator ()
+  {
+    return "!";
+  }
 };
 
 template <typename T>
@@ -198,6 +270,10 @@ struct Negater
   {
     return -x;
   }
+  static const char* native_operator ()
+  {
+    return "-";
+  }
 };
 
 ExpressionValueList collect_evals (ast::Node* node);
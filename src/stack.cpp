@@ -103,6 +103,19 @@ Stack::store (void* ptr,
   std::memcpy (ptr, top_, size);
 }
 
+void*
+Stack::store_indirect (size_t size)
+{
+  size_t s = util::align_up (size, arch::stack_alignment ());
+  size_t p = util::align_up (sizeof (void*), arch::stack_alignment ());
+  assert (top_ - s - p >= data_);
+  void* ptr;
+  std::memcpy (&ptr, top_ - s - p, sizeof (void*));
+  std::memcpy (ptr, top_ - s, size);
+  top_ -= s + p;
+  return ptr;
+}
+
 void
 Stack::move (ptrdiff_t offset,
              size_t size)
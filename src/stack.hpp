@@ -63,6 +63,11 @@ struct Stack
   void store (void* ptr,
               size_t size);
 
+  // Copy size bytes from the top of the stack to the pointer beneath them
+  // and remove the bytes and the pointer from the stack.
+  // Return the pointer.
+  void* store_indirect (size_t size);
+
   // Copy size bytes from ptr to base_pointer + offset.
   void write (ptrdiff_t offset,
               const void* ptr,
@@ -80,6 +85,39 @@ struct Stack
   void move (ptrdiff_t offset,
              size_t size);
 
+  // Versions of load, store, and move for sizes known at compile time.
+  template <size_t N>
+  void
+  load (const void* ptr)
+  {
+    size_t s = util::align_up (N, arch::stack_alignment ());
+    assert (top_ + s <= limit_);
+    std::memcpy (top_, ptr, N);
+    top_ += s;
+  }
+
+  template <size_t N>
+  void
+  store (void* ptr)
+  {
+    size_t s = util::align_up (N, arch::stack_alignment ());
+    assert (top_ - s >= data_);
+    top_ -= s;
+    std::memcpy (ptr, top_, N);
+  }
+
+  template <size_t N>
+  void
+  move (ptrdiff_t offset)
+  {
+    size_t s = util::align_up (N, arch::stack_alignment ());
+    char* ptr = base_pointer_ + offset;
+    assert (ptr >= data_ && ptr + N <= top_);
+    assert (top_ - s >= data_);
+    top_ -= s;
+    std::memcpy (ptr, top_, N);
+  }
+
   // Clear size bytes at base_pointer + offset.
   void clear (ptrdiff_t offset,
               size_t size);
@@ -177,12 +177,16 @@ struct Getter;
 namespace runtime
 {
 class ComponentInfoBase;
+class Compiler;
 class ExecutorBase;
 class FileDescriptor;
 class Heap;
 class ListOperation;
 class MemoryModel;
+struct Native;
+class NativeModule;
 class Operation;
+class PointerMap;
 class Stack;
 }
 
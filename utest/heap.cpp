@@ -1,6 +1,9 @@
 #include "heap.hpp"
 
 #include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
 
 #include "tap.hpp"
 
@@ -15,11 +18,6 @@ struct Link
   Link () : heap (NULL), next (NULL) { }
 };
 
-bool BlockSorter (const Block* x, const Block* y)
-{
-  return x->begin () < y->begin ();
-}
-
 int
 main (int argc, char** argv)
 {
@@ -99,6 +97,23 @@ main (int argc, char** argv)
     delete h;
   }
 
+  {
+    // Marking an object does not mark its neighbors.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    Link* obj1 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    Link* obj2 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    Link* obj3 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    obj1->next = NULL;
+    obj2->next = NULL;
+    obj3->next = NULL;
+    root.next = reinterpret_cast<Link*> (&obj2->value);
+    h->collect_garbage (true);
+    tap.tassert ("Heap::collect_garbage interior pointer retains object", h->is_allocated (obj2) == true && h->is_object (obj2) == true);
+    tap.tassert ("Heap::collect_garbage neighbors are collected", h->is_allocated (obj1) == false && h->is_allocated (obj3) == false);
+    delete h;
+  }
+
   {
     Link root1;
     Heap* h1 = new Heap (&root1, sizeof (Link));
@@ -182,63 +197,550 @@ main (int argc, char** argv)
   }
 
   {
-    // Create a simple tree and delete it.
-    std::vector<Block*> blocks;
-    blocks.push_back (Block::make (1));
-    blocks.push_back (Block::make (1));
-    blocks.push_back (Block::make (1));
-    std::sort (blocks.begin (), blocks.end (), BlockSorter);
-    Block* root = blocks[1];
-    Block::insert (&root, blocks[0]);
-    Block::insert (&root, blocks[2]);
-    delete root;
+    // An object without pointers is not scanned.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    PointerMap none (sizeof (Link));
+    Link* obj = static_cast<Link*> (h->allocate (sizeof (Link), &none));
+    Link* target = static_cast<Link*> (h->allocate (sizeof (Link)));
+    obj->next = target;
+    root.next = obj;
+    h->collect_garbage (true);
+    tap.tassert ("Heap::collect_garbage no pointers retained", h->is_allocated (obj) == true);
+    tap.tassert ("Heap::collect_garbage no pointers not scanned", h->is_allocated (target) == false);
+    delete h;
+  }
+
+  {
+    // Only the pointers in the pointer map are followed.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    PointerMap pm (sizeof (Link));
+    pm.offsets.push_back (offsetof (Link, next));
+    Link* arr = static_cast<Link*> (h->allocate (2 * sizeof (Link), &pm));
+    Link* target1 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    Link* target2 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    Link* target3 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    arr[0].next = target1;
+    arr[0].heap = reinterpret_cast<Heap*> (target2);
+    arr[1].next = target3;
+    root.next = arr;
+    h->collect_garbage (true);
+    tap.tassert ("Heap::collect_garbage pointer map followed", h->is_allocated (target1) == true && h->is_allocated (target3) == true);
+    tap.tassert ("Heap::collect_garbage pointer map skipped", h->is_allocated (target2) == false);
+    delete h;
+  }
+
+  {
+    // Compaction moves typed objects out of sparse blocks.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    GcPolicy policy;
+    policy.compact = true;
+    h->policy (policy);
+    PointerMap pm (sizeof (Link));
+    pm.offsets.push_back (offsetof (Link, heap));
+    pm.offsets.push_back (offsetof (Link, next));
+    const size_t count = 2000;
+    Link* nodes[count];
+    Link* head = NULL;
+    for (size_t idx = 0; idx != count; ++idx)
+      {
+        Link* node = static_cast<Link*> (h->allocate (sizeof (Link), &pm));
+        node->value = idx;
+        node->next = head;
+        head = node;
+        nodes[idx] = node;
+        for (size_t k = 0; k != 7; ++k)
+          {
+            h->allocate (sizeof (Link), &pm);
+          }
+      }
+    root.next = head;
+    // A word in an object without a pointer map pins its target.
+    Link* pinner = static_cast<Link*> (h->allocate (sizeof (Link)));
+    pinner->next = nodes[count / 2];
+    nodes[count - 2]->heap = reinterpret_cast<Heap*> (pinner);
+    bool moved = h->compact ();
+    bool intact = true;
+    size_t n = 0;
+    for (Link* l = root.next; l != NULL; l = l->next, ++n)
+      {
+        intact = intact && l->value == static_cast<int> (count - 1 - n) && h->is_allocated (l);
+      }
+    Link* pinner2 = reinterpret_cast<Link*> (root.next->next->heap);
+    tap.tassert ("Heap::compact moved", moved == true);
+    tap.tassert ("Heap::compact list intact", intact && n == count);
+    tap.tassert ("Heap::compact root pinned", root.next == nodes[count - 1]);
+    tap.tassert ("Heap::compact conservative pinned", pinner2->next == nodes[count / 2] && nodes[count / 2]->value == static_cast<int> (count / 2));
+    tap.tassert ("Heap::compact old copy freed", root.next->next != nodes[count - 2] && h->is_allocated (nodes[count - 2]) == false);
+    tap.tassert ("Heap::compact wants_compaction", h->wants_compaction () == false);
+    h->collect_garbage (true);
+    tap.tassert ("Heap::wants_compaction after collection", h->wants_compaction () == true);
+    delete h;
+  }
+
+  {
+    // Find the block for an address.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    Block* block = Block::make (h, 1);
+    char* begin = static_cast<char*> (block->begin ());
+    tap.tassert ("Block::make whole pages", block->size () > 0 && block->size () % 4096 == 0);
+    tap.tassert ("Block::find begin", Block::find (h, begin) == block);
+    tap.tassert ("Block::find end", Block::find (h, begin + block->size () - 1) == block);
+    tap.tassert ("Block::find other heap", Block::find (NULL, begin) == NULL);
+    tap.tassert ("Block::find outside", Block::find (h, &root) == NULL);
+    delete block;
+    tap.tassert ("Block::find deleted", Block::find (h, begin) == NULL);
+    delete h;
+  }
+
+  {
+    // Merging relabels the blocks and reparents the children.
+    Heap* h1 = new Heap (sizeof (Link));
+    Heap* h2 = new Heap (sizeof (Link));
+    Heap* c1 = new Heap (sizeof (Link));
+    Heap* c2 = new Heap (sizeof (Link));
+    h2->insert_child (c1);
+    h2->insert_child (c2);
+    void* obj = h2->allocate (sizeof (Link));
+    h1->merge (h2);
+    tap.tassert ("Heap::merge relabels blocks", h1->contains (obj) == true);
+    tap.tassert ("Heap::merge children", h1->is_child (c1) == true && h1->is_child (c2) == true);
+    c1->remove_from_parent ();
+    tap.tassert ("Heap::remove_from_parent merged child", h1->is_child (c1) == false && h1->is_child (c2) == true);
+    delete c1;
+    delete h1;
+  }
+
+  {
+    // An exclusive heap allocates and collects without its mutex.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    h->exclusive (true);
+    root.next = static_cast<Link*> (h->allocate (sizeof (Link)));
+    h->allocate (sizeof (Link));
+    h->collect_garbage (true);
+    tap.tassert ("Heap::exclusive", h->exclusive () == true);
+    h->exclusive (false);
+    tap.tassert ("Heap::exclusive collect", h->is_allocated (root.next) == true && h->exclusive () == false);
+    delete h;
+  }
+
+  {
+    // Reused memory is cleared except for the bytes the caller writes.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    char* p = static_cast<char*> (h->allocate (64));
+    memset (p, 0xff, 64);
+    h->collect_garbage (true);
+    char* q = static_cast<char*> (h->allocate_uninitialized (40));
+    tap.tassert ("Heap::allocate_uninitialized padding", q[40] == 0 && q[47] == 0);
+    char* r = static_cast<char*> (h->allocate (64));
+    bool zero = true;
+    for (size_t idx = 0; idx != 64; ++idx)
+      {
+        zero = zero && r[idx] == 0;
+      }
+    tap.tassert ("Heap::allocate reused zero", zero);
+    delete h;
+  }
+
+  {
+    // Released blocks are reused with zeroed storage.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    Block* block = Block::make (h, 3 * 4096);
+    tap.tassert ("Block::make size class", block->size () == 4 * 4096);
+    char* begin = static_cast<char*> (block->begin ());
+    memset (begin, 0xff, block->size ());
+    Block::release (block);
+    tap.tassert ("Block::release unmaps", Block::find (h, begin) == NULL);
+    block = Block::make (h, 4 * 4096);
+    tap.tassert ("Block::make reuses", block->begin () == begin && Block::find (h, begin) == block);
+    tap.tassert ("Block::make zeroed", begin[0] == 0 && begin[block->size () - 1] == 0);
+    Block::release (block);
+    block = Block::make (h, 64 * 1024);
+    begin = static_cast<char*> (block->begin ());
+    memset (begin, 0xff, block->size ());
+    Block::release (block);
+    block = Block::make (h, 64 * 1024);
+    tap.tassert ("Block::make mapped zeroed", block->begin () == begin && begin[0] == 0 && begin[block->size () - 1] == 0);
+    Block::release (block);
+    delete h;
   }
 
   {
     // Mark an unallocated region.
     Block* wl = NULL;
-    Block* root = Block::make (1);
+    Block* root = Block::make (NULL, 1);
     root->mark (root->begin (), &wl);
     delete root;
   }
 
   {
-    // Sweep the root but retain the left child.
-    std::vector<Block*> blocks;
-    blocks.push_back (Block::make (1));
-    blocks.push_back (Block::make (1));
-    std::sort (blocks.begin (), blocks.end (), BlockSorter);
-    Block* child = blocks[0];
-    Block* root = blocks[1];
-    Block::insert (&root, child);
-    Chunk c;
-    Chunk* head = &c;
-    child->set_mark ();
-    Block::sweep (&root, &head);
-    tap.tassert ("Block::sweep retain left", root == child);
-    delete root;
+    // Sweep the first block but retain the second.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    Block* list = NULL;
+    Block::merge (&list, Block::make (h, 1), h);
+    Block::merge (&list, Block::make (h, 1), h);
+    Block* first = list;
+    Block* second = list->link ();
+    FreeLists free_lists;
+    second->set_mark ();
+    tap.tassert ("Block::sweep free unmarked", first->sweep (&free_lists) == false);
+    tap.tassert ("Block::sweep retain marked", second->sweep (&free_lists) == true);
+    size_t size;
+    tap.tassert ("Block::sweep free slots", free_lists.remove_large (&size) == second->begin () && size == second->size ());
+    delete first;
+    delete second;
+    delete h;
   }
 
   {
-    // Sweep the root but retain the children.
-    std::vector<Block*> blocks;
-    blocks.push_back (Block::make (1));
-    blocks.push_back (Block::make (1));
-    blocks.push_back (Block::make (1));
-    blocks.push_back (Block::make (1));
-    std::sort (blocks.begin (), blocks.end (), BlockSorter);
-    Block* root = blocks[2];
-    Block::insert (&root, blocks[0]);
-    Block::insert (&root, blocks[3]);
-    Block::insert (&root, blocks[1]);
-    Chunk c;
-    Chunk* head = &c;
-    blocks[0]->set_mark ();
-    blocks[1]->set_mark ();
-    blocks[3]->set_mark ();
-    Block::sweep (&root, &head);
-    tap.tassert ("Block::sweep retain children", root == blocks[1]);
-    delete root;
+    // Objects in an unswept block are allocated only if marked.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    Link* obj1 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    Link* obj2 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    root.next = obj2;
+    h->collect_garbage (true);
+    tap.tassert ("Heap::collect_garbage lazy sweep", h->is_allocated (obj1) == false && h->is_object (obj1) == false && h->is_allocated (obj2) == true && h->is_object (obj2) == true);
+    Link* obj3 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    tap.tassert ("Heap::allocate sweeps", obj3 != obj2 && h->is_allocated (obj3) == true && h->is_allocated (obj2) == true && h->is_allocated (obj1) == false);
+    delete h;
+  }
+
+  {
+    // Allocate from a span and merge it.
+    Link root;
+    Heap* h1 = new Heap (&root, sizeof (Link));
+    Heap* h2 = new Heap (sizeof (Link));
+    Link* obj1 = static_cast<Link*> (h2->allocate (sizeof (Link)));
+    Link* obj2 = static_cast<Link*> (h2->allocate (sizeof (Link)));
+    char* next = reinterpret_cast<char*> (obj2) + (reinterpret_cast<char*> (obj2) - reinterpret_cast<char*> (obj1));
+    tap.tassert ("Heap::allocate bump", obj2 > obj1 && h2->is_object (obj2) == true && h2->is_allocated (obj2) == true);
+    h1->merge (h2);
+    tap.tassert ("Heap::merge span", h1->is_allocated (obj1) == true && h1->is_allocated (next) == false);
+    delete h1;
+  }
+
+  {
+    // A minor collection keeps old objects and frees young garbage.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    h->generational (true);
+    tap.tassert ("Heap::generational", h->generational () == true);
+    Link* old1 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    Link* old2 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    root.next = old1;
+    old1->next = old2;
+    h->collect_garbage (true);
+    root.next = NULL;
+    Link* young1 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    Link* young2 = static_cast<Link*> (h->allocate (sizeof (Link)));
+    young1->next = NULL;
+    young2->next = NULL;
+    old2->next = young1;
+    Heap::write_barrier (&old2->next, sizeof (Link*));
+    // Fill the nursery.
+    h->allocate (64 * 1024);
+    tap.tassert ("Heap::collect_garbage minor", h->collect_garbage () == true);
+    tap.tassert ("Heap::collect_garbage minor keeps old", h->is_allocated (old1) == true && h->is_allocated (old2) == true);
+    tap.tassert ("Heap::collect_garbage minor follows dirty cards", h->is_allocated (young1) == true);
+    tap.tassert ("Heap::collect_garbage minor frees young", h->is_allocated (young2) == false);
+    h->collect_garbage (true);
+    tap.tassert ("Heap::collect_garbage full frees old", h->is_allocated (old1) == false && h->is_allocated (old2) == false && h->is_allocated (young1) == false);
+    delete h;
+  }
+
+  {
+    // Pointers to young objects from old objects on clean cards are
+    // found through the roots.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    h->generational (true);
+    Link* old = static_cast<Link*> (h->allocate (sizeof (Link)));
+    root.next = old;
+    h->collect_garbage (true);
+    Link* young = static_cast<Link*> (h->allocate (sizeof (Link)));
+    young->next = NULL;
+    root.next = young;
+    old->next = NULL;
+    h->allocate (64 * 1024);
+    h->collect_garbage ();
+    tap.tassert ("Heap::collect_garbage minor marks from roots", h->is_allocated (young) == true && h->is_allocated (old) == true);
+    Heap::write_barrier (&root, sizeof (Link));
+    tap.tassert ("Heap::write_barrier outside heap", true);
+    delete h;
+  }
+
+  {
+    // Allocation past the threshold requests a collection.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    GcPolicy policy;
+    policy.growth = 4;
+    policy.min_size = 4096;
+    h->policy (policy);
+    Heap* child = new Heap (sizeof (Link));
+    h->insert_child (child);
+    root.heap = child;
+    h->collect_garbage (true);
+    tap.tassert ("Heap::wants_collection idle", h->wants_collection () == false && child->policy ().growth == 4);
+    root.next = static_cast<Link*> (h->allocate (2048));
+    tap.tassert ("Heap::wants_collection min_size", h->wants_collection () == false);
+    for (size_t idx = 0; idx != 4; ++idx)
+      {
+        child->allocate (2048);
+      }
+    tap.tassert ("Heap::wants_collection child", child->wants_collection () == true && h->wants_collection () == true);
+    h->collect_garbage ();
+    tap.tassert ("Heap::collect_garbage clears request", h->wants_collection () == false && child->wants_collection () == false);
+    delete h;
+  }
+
+  {
+    // The counters include the children.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    Heap* child = new Heap (sizeof (Link));
+    h->insert_child (child);
+    root.heap = child;
+    root.next = static_cast<Link*> (h->allocate (sizeof (Link)));
+    root.next->next = static_cast<Link*> (h->allocate (sizeof (Link)));
+    h->allocate (sizeof (Link));
+    child->allocate (sizeof (Link));
+    h->collect_garbage (true);
+    HeapStats stats;
+    h->stats (&stats);
+    tap.tassert ("Heap::stats heaps", stats.heaps == 2);
+    tap.tassert ("Heap::stats allocated", stats.allocated_bytes >= 4 * sizeof (Link));
+    tap.tassert ("Heap::stats live", stats.live_bytes >= 2 * sizeof (Link) && stats.live_bytes < stats.allocated_bytes);
+    tap.tassert ("Heap::stats blocks", stats.blocks >= 2 && stats.block_bytes >= stats.used_bytes && stats.fragmentation () < 1);
+    tap.tassert ("Heap::stats collections", stats.collections == 2 && stats.scanned_objects >= 2 && stats.max_pause_ns <= stats.pause_ns);
+    delete h;
+  }
+
+  {
+    // An incremental collection keeps objects whose pointers move
+    // while it is marking.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    GcPolicy policy;
+    policy.pause_budget = 1;
+    h->policy (policy);
+    const size_t count = 4096;
+    for (size_t idx = 0; idx != count; ++idx)
+      {
+        Link* l = static_cast<Link*> (h->allocate (sizeof (Link)));
+        l->next = root.next;
+        root.next = l;
+      }
+    h->collect_garbage ();
+    tap.tassert ("Heap::collect_garbage incremental step", h->collecting () == true);
+    Link* middle = root.next;
+    for (size_t idx = 0; idx != count / 2; ++idx)
+      {
+        middle = middle->next;
+      }
+    // Move the tail to an object allocated while marking.
+    Link* moved = static_cast<Link*> (h->allocate (sizeof (Link)));
+    moved->next = middle->next;
+    middle->next = NULL;
+    root.heap = reinterpret_cast<Heap*> (moved);
+    while (h->collecting ())
+      {
+        h->collect_garbage ();
+      }
+    size_t live = 0;
+    for (Link* l = root.next; l != NULL; l = l->next)
+      {
+        live += h->is_allocated (l);
+      }
+    for (Link* l = moved; l != NULL; l = l->next)
+      {
+        live += h->is_allocated (l);
+      }
+    tap.tassert ("Heap::collect_garbage incremental keeps moved objects", live == count + 1);
+    // Objects allocated after the collection survive the lazy sweep.
+    Link* after = static_cast<Link*> (h->allocate (sizeof (Link)));
+    after->next = moved;
+    root.heap = reinterpret_cast<Heap*> (after);
+    for (size_t idx = 0; idx != count; ++idx)
+      {
+        h->allocate (sizeof (Link));
+      }
+    tap.tassert ("Heap::collect_garbage incremental allocates after", h->is_allocated (after) == true && after->next == moved);
+    tap.tassert ("Heap::collect_garbage incremental finishes", h->collect_garbage (true) == true && h->collecting () == false);
+    delete h;
+  }
+
+  {
+    // Merging into a heap that is marking.
+    Link root;
+    Heap* h1 = new Heap (&root, sizeof (Link));
+    GcPolicy policy;
+    policy.pause_budget = 1;
+    h1->policy (policy);
+    for (size_t idx = 0; idx != 4096; ++idx)
+      {
+        Link* l = static_cast<Link*> (h1->allocate (sizeof (Link)));
+        l->next = root.next;
+        root.next = l;
+      }
+    h1->collect_garbage ();
+    Heap* h2 = new Heap (sizeof (Link));
+    Link* root2 = static_cast<Link*> (h2->root ());
+    Link* obj = static_cast<Link*> (h2->allocate (sizeof (Link)));
+    root2->next = obj;
+    h1->merge (h2);
+    root.heap = reinterpret_cast<Heap*> (root2);
+    while (h1->collecting ())
+      {
+        h1->collect_garbage ();
+      }
+    tap.tassert ("Heap::merge while marking", h1->is_allocated (root2) == true && h1->is_allocated (obj) == true);
+    delete h1;
+  }
+
+  {
+    // Every step of an incremental collection stays near its budget,
+    // including finishing the sweep and the final rescan.  The thread
+    // CPU time of a step is measured so preemption does not count.
+    // The heap is collected again as soon as a collection finishes so
+    // the next one starts with unswept blocks.
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    GcPolicy policy;
+    policy.growth = 1;
+    policy.pause_budget = 100000;
+    h->policy (policy);
+    const size_t count = 256 * 1024;
+    for (size_t idx = 0; idx != count; ++idx)
+      {
+        Link* l = static_cast<Link*> (h->allocate (sizeof (Link)));
+        l->next = root.next;
+        root.next = l;
+      }
+    h->collect_garbage (true);
+    HeapStats before;
+    h->stats (&before);
+    unsigned long max_pause = 0;
+    size_t steps = 0;
+    Link* l = root.next;
+    for (;;)
+      {
+        // Store pointers into old objects and allocate garbage between
+        // steps.
+        for (size_t idx = 0; idx != 64; ++idx)
+          {
+            Link* n = static_cast<Link*> (h->allocate (sizeof (Link)));
+            n->next = l->next;
+            l->next = n;
+            Heap::write_barrier (&l->next, sizeof (Link*));
+            l = n->next != NULL ? n->next : root.next;
+            h->allocate (sizeof (Link));
+          }
+        struct timespec begin;
+        struct timespec end;
+        clock_gettime (CLOCK_THREAD_CPUTIME_ID, &begin);
+        h->collect_garbage ();
+        clock_gettime (CLOCK_THREAD_CPUTIME_ID, &end);
+        max_pause = std::max (max_pause, static_cast<unsigned long> ((end.tv_sec - begin.tv_sec) * 1000000000UL + end.tv_nsec - begin.tv_nsec));
+        ++steps;
+        HeapStats stats;
+        h->stats (&stats);
+        if (stats.collections == before.collections + 2)
+          {
+            break;
+          }
+      }
+    tap.tassert ("Heap::collect_garbage incremental pause", max_pause < 10 * policy.pause_budget && steps > 2);
+    delete h;
+  }
+
+  {
+    // Small chunks are segregated by size and large chunks are first-fit.
+    const size_t slot = 2 * sizeof (void*);
+    union
+    {
+      Chunk chunk;
+      char bytes[64 * 2 * sizeof (void*)];
+    } storage;
+    char* base = storage.bytes;
+    FreeLists free_lists;
+    tap.tassert ("FreeLists::remove empty", free_lists.remove (slot) == NULL);
+    free_lists.insert (base, 2 * slot);
+    free_lists.insert (base + 2 * slot, slot);
+    tap.tassert ("FreeLists::remove exact", free_lists.remove (slot) == base + 2 * slot);
+    tap.tassert ("FreeLists::remove split small", free_lists.remove (slot) == base);
+    tap.tassert ("FreeLists::remove remainder", free_lists.remove (slot) == base + slot);
+    tap.tassert ("FreeLists::remove exhausted", free_lists.remove (slot) == NULL);
+    free_lists.insert (base, 20 * slot);
+    free_lists.insert (base + 20 * slot, 40 * slot);
+    tap.tassert ("FreeLists::remove first-fit", free_lists.remove (30 * slot) == base + 20 * slot);
+    tap.tassert ("FreeLists::remove large remainder", free_lists.remove (10 * slot) == base + 50 * slot);
+    tap.tassert ("FreeLists::remove split large", free_lists.remove (2 * slot) == base);
+    FreeLists other;
+    other.append (free_lists);
+    tap.tassert ("FreeLists::append moves", free_lists.remove (18 * slot) == NULL && other.remove (18 * slot) == base + 2 * slot);
+    other.clear ();
+    tap.tassert ("FreeLists::clear", other.remove (slot) == NULL);
+  }
+
+  {
+    // Helpers collect the children in parallel.
+    Heap::collector_threads (3);
+    Link root;
+    Heap* h = new Heap (&root, sizeof (Link));
+    const size_t count = 32;
+    Heap** children = static_cast<Heap**> (h->allocate (count * sizeof (Heap*)));
+    root.next = reinterpret_cast<Link*> (children);
+    Heap* all[count];
+    Link* objs[count];
+    for (size_t idx = 0; idx != count; ++idx)
+      {
+        Heap* child = new Heap (sizeof (Link));
+        h->insert_child (child);
+        Link* r = static_cast<Link*> (child->root ());
+        for (size_t k = 0; k != 100; ++k)
+          {
+            Link* obj = static_cast<Link*> (child->allocate (sizeof (Link)));
+            obj->next = r->next;
+            r->next = obj;
+          }
+        all[idx] = child;
+        objs[idx] = r->next;
+        if (idx % 2 == 0)
+          {
+            children[idx] = child;
+          }
+      }
+    h->collect_garbage (true);
+    bool kept = true;
+    size_t remaining = 0;
+    for (size_t idx = 0; idx != count; idx += 2)
+      {
+        kept = kept && h->is_child (children[idx]) && children[idx]->is_allocated (objs[idx]);
+      }
+    for (size_t idx = 0; idx != count; ++idx)
+      {
+        if (h->is_child (all[idx]))
+          {
+            ++remaining;
+          }
+      }
+    tap.tassert ("Heap::collector_threads keeps reachable children", kept);
+    tap.tassert ("Heap::collector_threads frees unreachable children", remaining == count / 2);
+    for (size_t idx = 0; idx != count; idx += 2)
+      {
+        children[idx]->allocate (1024 * 1024);
+      }
+    tap.tassert ("Heap::collector_threads collects children", h->collect_garbage () == true);
+    delete h;
   }
 
   tap.print_plan ();
@@ -0,0 +1,129 @@
+#include "heap.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+// Measure the time to allocate objects and to collect a heap against
+// the size of the heap.
+// The collector finds the block of every word it scans so the time
+// per object should not grow with the number of objects or blocks.
+//
+// Usage: heap_benchmark [MAX_OBJECTS]
+
+using namespace runtime;
+
+struct Link
+{
+  Link* next;
+  long value;
+};
+
+static double now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char* kind, size_t objects, double seconds)
+{
+  printf ("%-8s %10zd %12.6f %10.2f\n", kind, objects, seconds, seconds * 1e9 / objects);
+}
+
+// A list of objects allocated in one heap.
+static void list (size_t count)
+{
+  Link root;
+  root.next = NULL;
+  Heap* h = new Heap (&root, sizeof (Link));
+  double begin = now ();
+  for (size_t idx = 0; idx != count; ++idx)
+    {
+      Link* l = static_cast<Link*> (h->allocate (sizeof (Link)));
+      l->next = root.next;
+      root.next = l;
+    }
+  report ("allocate", count, now () - begin);
+  // The first collection establishes the pacing.
+  h->collect_garbage (true);
+  begin = now ();
+  h->collect_garbage (true);
+  report ("list", count, now () - begin);
+  delete h;
+}
+
+// A list of old objects in a generational heap followed by a nursery
+// of garbage.  The minor collection should not grow with the number of
+// old objects.
+static void young (size_t count)
+{
+  Link root;
+  root.next = NULL;
+  Heap* h = new Heap (&root, sizeof (Link));
+  h->generational (true);
+  for (size_t idx = 0; idx != count; ++idx)
+    {
+      Link* l = static_cast<Link*> (h->allocate (sizeof (Link)));
+      l->next = root.next;
+      root.next = l;
+    }
+  h->collect_garbage (true);
+  for (size_t idx = 0; idx != 8192; ++idx)
+    {
+      h->allocate (sizeof (Link));
+    }
+  double begin = now ();
+  h->collect_garbage ();
+  report ("minor", count, now () - begin);
+  delete h;
+}
+
+// A list of objects allocated in child heaps and merged into one heap.
+// Each child contributes a block.
+static void merged (size_t count)
+{
+  Link root;
+  root.next = NULL;
+  Heap* h = new Heap (&root, sizeof (Link));
+  for (size_t idx = 0; idx != count; ++idx)
+    {
+      Heap* child = new Heap (sizeof (Link));
+      Link* l = static_cast<Link*> (child->root ());
+      l->next = root.next;
+      root.next = l;
+      h->merge (child);
+    }
+  h->collect_garbage (true);
+  double begin = now ();
+  h->collect_garbage (true);
+  report ("merged", count, now () - begin);
+  delete h;
+}
+
+int
+main (int argc, char** argv)
+{
+  size_t max_objects = 1 << 20;
+  if (argc > 1)
+    {
+      max_objects = strtoul (argv[1], NULL, 0);
+    }
+
+  printf ("%-8s %10s %12s %10s\n", "kind", "objects", "seconds", "ns/object");
+  for (size_t count = 1 << 10; count <= max_objects; count *= 2)
+    {
+      list (count);
+    }
+  for (size_t count = 1 << 10; count <= max_objects; count *= 2)
+    {
+      young (count);
+    }
+  // Merged heaps have a block per object.
+  for (size_t count = 1 << 10; count <= max_objects / 16; count *= 2)
+    {
+      merged (count);
+    }
+
+  return 0;
+}
@@ -78,6 +78,36 @@ main (int argc, char** argv)
     tap.tassert ("Stack::write/read ()", x == y);
   }
 
+  {
+    Stack s (1024);
+    int y = 0;
+    s.push_pointer (&y);
+    int const x = 5;
+    s.push (x);
+    s.store_indirect (sizeof (x));
+    tap.tassert ("Stack::store_indirect ()", x == y && s.empty ());
+  }
+
+  {
+    Stack s (1024);
+    long const x[3] = { 1, 2, 3 };
+    s.load<sizeof (x)> (x);
+    long y[3];
+    s.store<sizeof (y)> (y);
+    tap.tassert ("Stack::load/store<N> ()", y[0] == 1 && y[1] == 2 && y[2] == 3 && s.empty ());
+  }
+
+  {
+    Stack s (1024);
+    s.setup (8);
+    short const x = 5;
+    s.push (x);
+    s.move<sizeof (x)> (0);
+    short y;
+    s.read (0, &y, sizeof (y));
+    tap.tassert ("Stack::move<N> ()", x == y && s.size () == 16);
+  }
+
   {
     Stack s (1024);
     s.setup (8);